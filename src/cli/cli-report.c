@@ -506,12 +506,13 @@ static int export_config_and_run_event(
                 const char *dump_dir_name,
                 const char *event)
 {
-    /* Export overridden settings as environment variables */
-    GList *env_list = export_event_config(event);
+    /* Export overridden settings as environment variables of the commands */
+    state->env_vec = get_event_config_env_vec(event);
 
     int r = run_event_on_dir_name(state, dump_dir_name, event);
 
-    unexport_event_config(env_list);
+    string_vector_free(state->env_vec);
+    state->env_vec = NULL;
 
     return r;
 }
@@ -587,12 +588,12 @@ static problem_data_t *load_problem_data_if_not_yet(problem_data_t *problem_data
     return problem_data;
 }
 
-static int run_event_on_dir_name_batch(
-                struct run_event_state *state,
+/* Checks whether the event can be run without asking user */
+static bool can_run_event_noninteractively(
                 const char *dump_dir_name,
                 const char *event_name)
 {
-    int retval = -1;
+    bool retval = false;
     problem_data_t *problem_data = NULL;
 
     event_config_t *config = get_event_config(event_name);
@@ -622,16 +623,24 @@ static int run_event_on_dir_name_batch(
         }
     }
 
-    problem_data_free(problem_data);
-    problem_data = NULL;
-
-    retval = export_config_and_run_event(state, dump_dir_name, event_name);
+    retval = true;
 
  ret:
     problem_data_free(problem_data);
     return retval;
 }
 
+static int run_event_on_dir_name_batch(
+                struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event_name)
+{
+    if (!can_run_event_noninteractively(dump_dir_name, event_name))
+        return -1;
+
+    return export_config_and_run_event(state, dump_dir_name, event_name);
+}
+
 static int run_event_on_dir_name_interactively(
                 struct run_event_state *state,
                 const char *dump_dir_name,
@@ -820,6 +829,264 @@ int run_event_chain(const char *dump_dir_name, GList *chain, int interactive)
     return retval;
 }
 
+/*** Running events on many problems ***/
+
+struct batch_problem
+{
+    char *dump_dir_name;
+    struct batch_run *run;
+    /* The event which stopped processing of the problem, NULL if none */
+    const char *stopped_by;
+    /* < 0 if the event was not run, otherwise as run_event_chain() returns */
+    int retval;
+    /* A command asked for a value nobody can enter */
+    bool needs_input;
+};
+
+struct batch_run
+{
+    struct run_event_loop *loop;
+    const char *event_name;
+    /* Answer 'yes' instead of 'no' */
+    bool always_yes;
+    GList *pending;     /* struct batch_problem waiting for a state */
+    GList *idle_states; /* struct run_event_state */
+};
+
+static char *batch_log(char *log_line, void *param)
+{
+    struct batch_problem *problem = param;
+    char *msg = xasprintf("%s: %s", problem->dump_dir_name, log_line);
+    client_log(msg);
+    free(msg);
+    return log_line;
+}
+
+static void batch_alert(const char *msg, void *param)
+{
+    struct batch_problem *problem = param;
+    char *line = xasprintf("%s: %s", problem->dump_dir_name, msg);
+    client_log(line);
+    free(line);
+}
+
+/* Nobody can answer in the batch mode. The command gets an empty value, but
+ * the problem fails because the value may have been needed.
+ */
+static char *batch_ask(const char *msg, void *param)
+{
+    struct batch_problem *problem = param;
+    char *line = xasprintf("%s: %s", problem->dump_dir_name, msg);
+    client_log(line);
+    free(line);
+
+    problem->needs_input = true;
+    return xstrdup("");
+}
+
+/* 'yes' can create a new bug, close one as a duplicate, etc., which must not
+ * happen for many problems at once unless requested by -y
+ */
+static int batch_ask_yes_no(const char *msg, void *param)
+{
+    struct batch_problem *problem = param;
+    const bool yes = problem->run->always_yes;
+    char *line = xasprintf("%s: %s %s", problem->dump_dir_name, msg, yes ? _("y") : _("N"));
+    client_log(line);
+    free(line);
+
+    return yes;
+}
+
+static int batch_ask_yes_no_key(const char *key, const char *msg, void *param)
+{
+    return batch_ask_yes_no(msg, param);
+}
+
+static void batch_start_next(struct batch_run *run);
+
+static void batch_event_done(struct run_event_state *state,
+                const char *dump_dir_name,
+                int retval,
+                void *param)
+{
+    struct batch_problem *problem = param;
+    struct batch_run *run = problem->run;
+
+    if (retval == 0 && state->children_count == 0)
+    {
+        printf("%s: Error: no processing is specified for event '%s'\n", dump_dir_name, run->event_name);
+        retval = 1;
+    }
+    else if (retval != 0)
+    {
+        char *msg = exit_status_as_string(run->event_name, state->process_status);
+        printf("%s: %s", dump_dir_name, msg);
+        free(msg);
+    }
+
+    if (retval == 0 && problem->needs_input)
+    {
+        printf("%s: Error: '%s' needs input which can't be entered in batch mode\n", dump_dir_name, run->event_name);
+        retval = 1;
+    }
+
+    problem->retval = retval;
+    if (retval != 0)
+        problem->stopped_by = run->event_name;
+
+    run->idle_states = g_list_prepend(run->idle_states, state);
+    batch_start_next(run);
+}
+
+/* Starts the event on the pending problems while there are idle states */
+static void batch_start_next(struct batch_run *run)
+{
+    while (run->pending && run->idle_states)
+    {
+        struct batch_problem *problem = run->pending->data;
+        run->pending = g_list_delete_link(run->pending, run->pending);
+
+        struct run_event_state *state = run->idle_states->data;
+        run->idle_states = g_list_delete_link(run->idle_states, run->idle_states);
+
+        state->logging_param = problem;
+        state->interaction_param = problem;
+        run_event_loop_add(run->loop, state, problem->dump_dir_name, run->event_name,
+                           batch_event_done, problem);
+    }
+}
+
+static const char *batch_problem_result(const struct batch_problem *problem)
+{
+    if (!problem->stopped_by)
+        return _("OK");
+    if (problem->retval < 0)
+        return _("not run");
+    if (problem->needs_input)
+        return _("needs input");
+    return _("failed");
+}
+
+static int run_event_chain_batch_with_rules(GList *dump_dir_names,
+                GList *chain,
+                unsigned max_jobs,
+                bool always_yes,
+                struct rule_index *rules)
+{
+    if (max_jobs == 0)
+        max_jobs = 1;
+
+    struct batch_run run = { 0 };
+    run.loop = run_event_loop_new();
+    run.always_yes = always_yes;
+
+    const unsigned count = g_list_length(dump_dir_names);
+    struct batch_problem *problems = xzalloc(count * sizeof(*problems));
+    unsigned i = 0;
+    for (GList *iter = dump_dir_names; iter; iter = g_list_next(iter), ++i)
+    {
+        problems[i].dump_dir_name = iter->data;
+        problems[i].run = &run;
+    }
+
+    const unsigned state_count = MIN(max_jobs, count);
+    struct run_event_state **states = xzalloc(state_count * sizeof(*states));
+    for (i = 0; i < state_count; ++i)
+    {
+        struct run_event_state *state = states[i] = new_run_event_state();
+        state->shared_rule_index = rules;
+        state->logging_callback = batch_log;
+        state->alert_callback = batch_alert;
+        state->ask_callback = batch_ask;
+        state->ask_password_callback = batch_ask;
+        state->ask_yes_no_callback = batch_ask_yes_no;
+        state->ask_yes_no_yesforever_callback = batch_ask_yes_no_key;
+        state->ask_yes_no_save_result_callback = batch_ask_yes_no_key;
+        run.idle_states = g_list_append(run.idle_states, state);
+    }
+
+    for (GList *eitem = chain; eitem; eitem = g_list_next(eitem))
+    {
+        run.event_name = eitem->data;
+
+        for (i = 0; i < count; ++i)
+        {
+            struct batch_problem *problem = &problems[i];
+            if (problem->stopped_by)
+                continue;
+
+            if (!can_run_event_noninteractively(problem->dump_dir_name, run.event_name))
+            {
+                /* Nothing was run (bad backtrace, etc... */
+                problem->retval = -1;
+                problem->stopped_by = run.event_name;
+                continue;
+            }
+            run.pending = g_list_prepend(run.pending, problem);
+        }
+        run.pending = g_list_reverse(run.pending);
+
+        /* Export overridden settings as environment variables of the commands */
+        char **env_vec = get_event_config_env_vec(run.event_name);
+        for (i = 0; i < state_count; ++i)
+            states[i]->env_vec = env_vec;
+
+        batch_start_next(&run);
+        run_event_loop_run(run.loop);
+
+        for (i = 0; i < state_count; ++i)
+            states[i]->env_vec = NULL;
+        string_vector_free(env_vec);
+    }
+
+    int exitcode = 0;
+    for (i = 0; i < count; ++i)
+    {
+        const struct batch_problem *problem = &problems[i];
+        if (problem->stopped_by)
+        {
+            printf("%s: %s (%s)\n", problem->dump_dir_name, batch_problem_result(problem), problem->stopped_by);
+            exitcode = 1;
+        }
+        else
+            printf("%s: %s\n", problem->dump_dir_name, batch_problem_result(problem));
+    }
+
+    g_list_free(run.idle_states);
+    for (i = 0; i < state_count; ++i)
+        free_run_event_state(states[i]);
+    free(states);
+    free(problems);
+    run_event_loop_free(run.loop);
+
+    return exitcode;
+}
+
+/*
+ * Runs the chain of events on every problem as run_event_chain() does
+ * without interaction, but runs up to max_jobs events at once.
+ *
+ * The events are run one after another: an event is started on all problems
+ * not stopped by the previous events before the next event is started.
+ * Every event's configuration is exported only once for all problems and the
+ * rules are loaded only once for the whole batch.
+ *
+ * Questions are answered 'no' unless always_yes is set. A problem whose
+ * command asks for a value fails.
+ *
+ * Prints a summary with the result of every problem, returns 0 if the chain
+ * succeeded on all problems, 1 otherwise.
+ */
+int run_event_chain_batch(GList *dump_dir_names, GList *chain, unsigned max_jobs, bool always_yes)
+{
+    struct rule_index *rules = rule_index_load();
+    const int exitcode = run_event_chain_batch_with_rules(dump_dir_names, chain, max_jobs, always_yes, rules);
+    rule_index_free(rules);
+
+    return exitcode;
+}
+
 static workflow_t *select_workflow(GHashTable *workflows)
 {
     GList *wf_list = g_hash_table_get_values(workflows);
@@ -25,6 +25,7 @@ extern "C" {
 int select_and_run_one_event(const char *dump_dir_name, const char *pfx, int interactive);
 int run_event_chain(const char *dump_dir_name, GList *chain, int interactive);
 int select_and_run_workflow(const char *dump_dir_name, GHashTable *workflows, int interactive);
+int run_event_chain_batch(GList *dump_dir_names, GList *chain, unsigned max_jobs, bool always_yes);
 
 #ifdef __cplusplus
 }
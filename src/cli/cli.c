@@ -37,6 +37,16 @@ static char *steal_directory_if_needed(char *dump_dir_name)
     return dump_dir_name;
 }
 
+/* Takes ownership of dump_dir_name */
+static GList *add_dump_dir_name(GList *dump_dir_names, char *dump_dir_name)
+{
+    char *stolen = steal_directory_if_needed(dump_dir_name);
+    if (stolen != dump_dir_name)
+        free(dump_dir_name);
+
+    return g_list_prepend(dump_dir_names, stolen);
+}
+
 int main(int argc, char** argv)
 {
     abrt_init(argv);
@@ -57,11 +67,13 @@ int main(int argc, char** argv)
 
     GList *event_list = NULL;
     const char *pfx = "";
+    int jobs = 0;
 
     /* Can't keep these strings/structs static: _() doesn't support that */
     const char *program_usage_string = _(
             "& [-vsp] -L[PREFIX] [PROBLEM_DIR]"
         "\n""   or: & [-vspy] -e EVENT PROBLEM_DIR"
+        "\n""   or: & [-vsp] -b [-j NUM] -e EVENT [PROBLEM_DIR]..."
         "\n""   or: & [-vspy] -d PROBLEM_DIR"
         "\n""   or: & [-vspy] -x PROBLEM_DIR"
     );
@@ -75,8 +87,10 @@ int main(int argc, char** argv)
         OPT_v            = 1 << 6,
         OPT_s            = 1 << 7,
         OPT_p            = 1 << 8,
+        OPT_batch        = 1 << 9,
+        OPT_jobs         = 1 << 10,
         /* An virtual option used when no other operation is specified */
-        OPT_workflow     = 1 << 9,
+        OPT_workflow     = 1 << 11,
         OPTMASK_op       = OPT_list_events|OPT_run_event|OPT_delete|OPT_expert|OPT_version,
         OPTMASK_need_arg = OPT_run_event|OPT_delete|OPT_expert|OPT_workflow
     };
@@ -92,6 +106,8 @@ int main(int argc, char** argv)
         OPT__VERBOSE(&g_verbose),
         OPT_BOOL(     's', NULL     , NULL,                    _("Log to syslog")),
         OPT_BOOL(     'p', NULL     , NULL,                    _("Add program names to log")),
+        OPT_BOOL(     'b', "batch"  , NULL,                    _("Run EVENTs on many PROBLEM_DIRs (read from stdin if none is given)")),
+        OPT_INTEGER(  'j', "jobs"   , &jobs,                   _("With -b: run up to NUM events at once (default: number of CPUs)")),
         OPT_END()
     };
     unsigned opts = parse_opts(argc, argv, program_options, program_usage_string);
@@ -109,7 +125,13 @@ int main(int argc, char** argv)
     argc -= optind;
 
     /* Check for bad usage */
-    if (argc > 1 /* more than one arg? */
+    if (opts & OPT_batch)
+    {
+        /* -b modifies -e, any number of args is accepted */
+        if (op != OPT_run_event)
+            show_usage_and_die(program_usage_string, program_options);
+    }
+    else if (argc > 1 /* more than one arg? */
         ||
         /* dont_need_arg == have_arg? bad in both cases:
          * TRUE == TRUE (dont need arg but have) or
@@ -136,8 +158,8 @@ int main(int argc, char** argv)
 
     char *dump_dir_name = argv[0];
 
-    /* Get settings */
-    load_event_config_data();
+    /* Get settings, the events are loaded when they are run */
+    load_event_config_data_lazily();
 
     /* At least, needed by ASK_YES_NO_YESFOREVER event command requests.
      * Removing of the following statement will get the yes forever stuff not
@@ -162,6 +184,34 @@ int main(int argc, char** argv)
         }
         case OPT_run_event: /* -e EVENT: run event */
         {
+            if (opts & OPT_batch)
+            {
+                GList *dump_dir_names = NULL;
+                if (argc == 0)
+                {
+                    char *line;
+                    while ((line = xmalloc_fgetline(stdin)) != NULL)
+                    {
+                        if (line[0] != '\0')
+                            dump_dir_names = add_dump_dir_name(dump_dir_names, line);
+                        else
+                            free(line);
+                    }
+                }
+                for (int i = 0; i < argc; ++i)
+                    dump_dir_names = add_dump_dir_name(dump_dir_names, xstrdup(argv[i]));
+                dump_dir_names = g_list_reverse(dump_dir_names);
+
+                if (jobs <= 0)
+                {
+                    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                    jobs = cpus > 1 ? cpus : 1;
+                }
+                exitcode = run_event_chain_batch(dump_dir_names, event_list, jobs, opts & OPT_y);
+                list_free_with_free(dump_dir_names);
+                break;
+            }
+
             dump_dir_name = steal_directory_if_needed(dump_dir_name);
             exitcode = run_event_chain(dump_dir_name, event_list, !(opts & OPT_y));
             break;
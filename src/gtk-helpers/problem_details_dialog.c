@@ -62,7 +62,7 @@ problem_details_dialog_new_for_dir(const char *dir, GtkWindow *parent)
 {
     INITIALIZE_LIBREPORT();
 
-    struct dump_dir *dd = dd_opendir(dir, DD_OPEN_READONLY);
+    struct dump_dir *dd = dd_opendir(dir, DD_OPEN_SHARED);
     if (!dd)
         return NULL;
 
@@ -34,7 +34,7 @@ void problem_data_reload_from_dump_dir(void)
 {
     free(g_events);
 
-    struct dump_dir *dd = dd_opendir(g_dump_dir_name, DD_OPEN_READONLY);
+    struct dump_dir *dd = dd_opendir(g_dump_dir_name, DD_OPEN_SHARED);
     if (!dd)
         xfunc_die(); /* dd_opendir already logged error msg */
 
@@ -2004,7 +2004,7 @@ static gboolean consume_cmd_output(GIOChannel *source, GIOCondition condition, g
          * even if exit code is "success".
          */
         if (!dd) /* why? because dd may be already open by the code above */
-            dd = dd_opendir(g_dump_dir_name, DD_OPEN_READONLY | DD_FAIL_QUIETLY_EACCES);
+            dd = dd_opendir(g_dump_dir_name, DD_OPEN_SHARED | DD_FAIL_QUIETLY_EACCES);
         if (!dd)
             xfunc_die();
         char *not_reportable = dd_load_text_ext(dd, FILENAME_NOT_REPORTABLE, 0
@@ -2704,7 +2704,7 @@ static char *get_next_processed_event(GList **events_list)
     {
         log_info("Expanding event '%s'", event_name);
 
-        struct dump_dir *dd = dd_opendir(g_dump_dir_name, DD_OPEN_READONLY);
+        struct dump_dir *dd = dd_opendir(g_dump_dir_name, DD_OPEN_SHARED);
         if (!dd)
             error_msg_and_die("Can't open directory '%s'", g_dump_dir_name);
 
@@ -0,0 +1,91 @@
+/*
+    Copyright (C) 2016  ABRT team
+    Copyright (C) 2016  RedHat Inc
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* Reloading of the configuration when its files change
+ *
+ * Long running processes create a watcher after loading the configuration,
+ * wait until its file descriptor is readable (e.g. by poll() or
+ * g_io_add_watch()) and call config_watcher_process(). Only the events and
+ * workflows whose files changed are parsed again:
+ *
+ *   struct config_watcher *watcher = config_watcher_new(on_change, NULL);
+ *   ...
+ *   struct pollfd pfd = { .fd = config_watcher_get_fd(watcher), .events = POLLIN };
+ *   if (poll(&pfd, 1, timeout) > 0)
+ *       config_watcher_process(watcher);
+ */
+#ifndef LIBREPORT_CONFIG_WATCHER_H_
+#define LIBREPORT_CONFIG_WATCHER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum config_watcher_item {
+    CONFIG_WATCHER_EVENT,    /* event_config_t in g_event_config_list */
+    CONFIG_WATCHER_WORKFLOW, /* workflow_t in g_workflow_list */
+    CONFIG_WATCHER_GLOBAL,   /* global configuration (libreport.conf) */
+};
+
+/*
+ * Called after a configuration item was reloaded. The previous event_config_t
+ * or workflow_t of the name has been freed at that time, pointers to it must
+ * not be used anymore.
+ *
+ * @param name The name of the event or workflow, NULL for the global
+ *        configuration
+ */
+typedef void (*config_watcher_callback)(enum config_watcher_item item, const char *name, void *param);
+
+struct config_watcher;
+
+/*
+ * Starts watching EVENTS_DIR, EVENTS_CONF_DIR, the user's events cache,
+ * WORKFLOWS_DIR, CONF_DIR and the user's configuration directory.
+ *
+ * Only the data which have been loaded are reloaded: g_event_config_list by
+ * load_event_config_data*(), g_workflow_list by load_workflow_config_data()
+ * and the global configuration by load_global_configuration().
+ *
+ * @param callback Can be NULL
+ * @return NULL if inotify can't be used
+ */
+#define config_watcher_new libreport_config_watcher_new
+struct config_watcher *config_watcher_new(config_watcher_callback callback, void *param);
+
+#define config_watcher_free libreport_config_watcher_free
+void config_watcher_free(struct config_watcher *watcher);
+
+/* Returns the file descriptor which becomes readable when there are changes */
+#define config_watcher_get_fd libreport_config_watcher_get_fd
+int config_watcher_get_fd(struct config_watcher *watcher);
+
+/*
+ * Reloads the changed configuration, does not block.
+ *
+ * @return The number of reloaded items, or -1 on error
+ */
+#define config_watcher_process libreport_config_watcher_process
+int config_watcher_process(struct config_watcher *watcher);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -91,6 +91,13 @@ enum dump_dir_flags {
      * exists and to perform stat operations.
      */
     DD_OPEN_FD_ONLY = (1 << 7),
+    /* Acquire a shared lock which allows other readers to open the directory
+     * at the same time. Writers are blocked until all readers close the
+     * directory. The dump directory opened with this flag is not locked for
+     * writing (dd->locked is 0) and must not be modified. If the shared lock
+     * cannot be acquired due to permissions, behaves like DD_OPEN_READONLY.
+     */
+    DD_OPEN_SHARED = (1 << 8),
 };
 
 struct dump_dir {
@@ -114,6 +121,10 @@ struct dump_dir {
      * dd_get_meta_data_dir_fd()
      */
     int dd_md_fd;
+    /* Name of the reader lock file if the directory was opened with
+     * DD_OPEN_SHARED; otherwise NULL.
+     */
+    char *dd_rlock_name;
 };
 
 void dd_close(struct dump_dir *dd);
@@ -327,6 +338,20 @@ int dd_chown(struct dump_dir *dd, uid_t new_uid);
  */
 off_t dd_compute_size(struct dump_dir *dd, int flags);
 
+/* Re-creates the index of dump directory items from scratch.
+ *
+ * The index lets dd_get_items_count() and dd_compute_size() answer without
+ * stat-ing every item. It is created together with the dump directory and
+ * kept up to date by the dd_* functions modifying the items. An index which
+ * does not list the items of the directory is rebuilt automatically, but
+ * items rewritten in place are not noticed. Call this function after the
+ * directory was modified by other means.
+ *
+ * @return 0 on success; otherwise negative errno and the dump directory is
+ * left without index.
+ */
+int dd_rebuild_index(struct dump_dir *dd);
+
 /* Sets a new owner (does NOT chown the directory)
  *
  * Does not validate the passed uid.
@@ -432,6 +457,14 @@ GList *read_entire_reported_to(struct dump_dir *dd);
 
 
 void delete_dump_dir(const char *dirname);
+/* Removes the index of dump directory items (see dd_rebuild_index()).
+ *
+ * Must be called before the directory is handed over to a tool which might
+ * modify the items without using this library.
+ *
+ * @return 0 on success (also if there was no index); otherwise negative errno.
+ */
+int dump_dir_remove_index(const char *dirname);
 /* Checks dump dir accessibility for particular uid.
  *
  * If the directory doesn't exist the directory is not accessible and errno is
@@ -497,7 +530,13 @@ struct dump_dir *create_dump_dir_ext(const char *base_dir_name, const char *type
  *
  * The archive type is deduced from archive_name suffix. The supported archive
  * suffixes are the following:
- *   - '.tag.gz' (note: the implementation uses child gzip process)
+ *   - '.tar.gz'
+ *   - '.tar.zst'
+ *   - '.tar.xz'
+ *
+ * The archive is compressed in-process on multiple threads when libreport is
+ * built with the corresponding compression library; otherwise a child
+ * process of the compression tool is used.
  *
  * The archive will include only the files that are not in the exclude_elements
  * list. See get_global_always_excluded_elements().
@@ -505,13 +544,29 @@ struct dump_dir *create_dump_dir_ext(const char *base_dir_name, const char *type
  * The argument "flags" is currently unused.
  *
  * @return 0 on success; otherwise non-0 value. -ENOSYS if archive type is not
- * supported. -EEXIST if the archive file already exists. -ECHILD if child
- * process fails. Other negative values can be converted to errno values by
+ * supported. -EEXIST if the archive file already exists. -ECHILD if the
+ * compression fails. Other negative values can be converted to errno values by
  * turning them positive.
  */
 int dd_create_archive(struct dump_dir *dd, const char *archive_name,
         const_string_vector_const_ptr_t exclude_elements, int flags);
 
+/* Writes the archive of the dump directory contents to the file descriptor fd
+ *
+ * Works like dd_create_archive() but does not create any file; the compressed
+ * archive is written to fd, which is left open. This allows the archive to be
+ * streamed, e.g. into a pipe. The archive_name argument is used only to
+ * deduce the archive type and does not need to exist.
+ *
+ * The function may be called from any thread and therefore does not touch
+ * the process-wide signal dispositions. The caller must ignore SIGPIPE if
+ * the reader of fd can go away before the archive is written.
+ *
+ * @return 0 on success; otherwise the same values as dd_create_archive().
+ */
+int dd_write_archive(struct dump_dir *dd, int fd, const char *archive_name,
+        const_string_vector_const_ptr_t exclude_elements, int flags);
+
 #ifdef __cplusplus
 }
 #endif
@@ -77,6 +77,8 @@ typedef struct
 event_option_t *new_event_option(void);
 void free_event_option(event_option_t *p);
 
+struct event_option_index;
+
 //structure to hold the option data
 typedef struct
 {
@@ -96,7 +98,8 @@ typedef struct
     bool  ec_requires_details;
 
     GList *ec_imported_event_names;
-    GList *options;
+    GList *options; /* event_option_t in the order of definition, add by ec_add_option() */
+    struct event_option_index *ec_option_index; /* see ec_get_option() */
 } event_config_t;
 
 event_config_t *new_event_config(const char *name);
@@ -112,6 +115,17 @@ const char *ec_get_long_desc(event_config_t *ec);
 void ec_set_long_desc(event_config_t *ec, const char *long_desc);
 bool ec_is_configurable(event_config_t* ec);
 
+/* Returns the option with the name, or NULL if there is none.
+ *
+ * The options are looked up by an index which is rebuilt if the options list
+ * was modified otherwise than by ec_add_option().
+ */
+event_option_t *ec_get_option(event_config_t *ec, const char *name);
+/* Appends the option at the end of the options, or replaces the option with
+ * the same name in place. The replaced option is freed.
+ */
+void ec_add_option(event_config_t *ec, event_option_t *opt);
+
 /* Returns True if the event is configured to create ticket with restricted
  * access.
  */
@@ -126,6 +140,21 @@ void load_event_description_from_file(event_config_t *event_config, const char*
 
 // (Re)loads data from /etc/abrt/events/*.{conf,xml}
 GHashTable *load_event_config_data(void);
+/* Indexes the names of the files only. An event is loaded from its files the
+ * first time get_event_config() asks for it.
+ * Returns g_event_config_list which contains only the loaded events.
+ */
+GHashTable *load_event_config_data_lazily(void);
+/* Loads all events which were indexed by load_event_config_data_lazily()
+ * and have not been loaded yet, e.g. to iterate through g_event_config_list.
+ */
+GHashTable *load_all_event_config_data(void);
+/* Loads the event from its files again and replaces it in g_event_config_list,
+ * or removes it if it has no files anymore. An event which has not been loaded
+ * yet in lazy mode is only indexed again. A new event is loaded if all events
+ * have been loaded by load_event_config_data() or load_all_event_config_data().
+ */
+void reload_event_config(const char *event_name);
 /* Frees all loaded data */
 void free_event_config_data(void);
 event_config_t *get_event_config(const char *event_name);
@@ -135,9 +164,15 @@ event_option_t *get_event_option_from_list(const char *option_name, GList *event
 void ec_print(event_config_t *ec);
 
 extern GHashTable *g_event_config_list;   // for iterating through entire list of all loaded configs
+                                          // (call load_all_event_config_data() first in lazy mode)
 
 GList *export_event_config(const char *event_name);
 void unexport_event_config(GList *env_list);
+/* Returns the variables export_event_config() would set as a NULL terminated
+ * vector of "NAME=value" strings, e.g. for env_vec of the commands run by
+ * run_event_state. Free it by string_vector_free().
+ */
+char **get_event_config_env_vec(const char *event_name);
 
 GList *get_options_with_err_msg(const char *event_name);
 
@@ -32,6 +32,16 @@ bool load_global_configuration(void);
 #define load_global_configuration_from_dirs libreport_load_global_configuration_from_dirs
 bool load_global_configuration_from_dirs(const char *dirs[], int dir_flags[]);
 
+/**
+ * Loads the configuration from the directories used by
+ * load_global_configuration() again, if it has been loaded. The current
+ * configuration is kept if the new one can't be loaded.
+ *
+ * @return false if the configuration has not been loaded or can't be loaded
+ */
+#define reload_global_configuration libreport_reload_global_configuration
+bool reload_global_configuration(void);
+
 #define free_global_configuration libreport_free_global_configuration
 void free_global_configuration(void);
 
@@ -212,6 +212,39 @@ int decompress_file(const char *path_in, const char *path_out, mode_t mode_out);
 int decompress_file_ext_at(const char *path_in, int dir_fd, const char *path_out,
         mode_t mode_out, uid_t uid, gid_t gid, int src_flags, int dst_flags);
 
+typedef enum {
+        COMPRESSION_GZIP,
+        COMPRESSION_ZSTD,
+        COMPRESSION_XZ,
+} libreport_compression_format;
+
+/* Compresses everything read from fdi up to EOF and writes it to fdo.
+ * Uses all online CPUs if the format allows it.
+ *
+ * @returns 0 on success; otherwise non-0 value.
+ */
+#define compress_fd libreport_compress_fd
+int compress_fd(libreport_compression_format format, int fdi, int fdo);
+/* Returns the compression format for the archive name suffix (.tar.gz,
+ * .tar.zst, .tar.xz) or -ENOSYS if the suffix is not known.
+ */
+#define archive_compression_format libreport_archive_compression_format
+int archive_compression_format(const char *archive_name);
+
+/* Compresses data in a separate thread.
+ *
+ * Returns a file descriptor where the uncompressed data are to be written or
+ * a negative errno value. The compressed data are written to fdo. The caller
+ * must close the returned file descriptor and then call compressor_finish()
+ * which waits for the compression to finish.
+ */
+struct compressor;
+#define compressor_start libreport_compressor_start
+int compressor_start(libreport_compression_format format, int fdo, struct compressor **compressor);
+/* @returns 0 if all data were compressed and written; otherwise non-0 value. */
+#define compressor_finish libreport_compressor_finish
+int compressor_finish(struct compressor *compressor);
+
 // NB: will return short read on error, not -1,
 // if some data was read before error occurred
 #define xread libreport_xread
@@ -329,6 +362,11 @@ enum {
  * env_vec: list of variables to set in environment (if string has
  * "VAR=VAL" form) or unset in environment (if string has no '=' char).
  *
+ * The child is started by posix_spawn() unless EXECFLG_SETGUID is used or
+ * the system can't change its directory or session that way.
+ *
+ * pipefds are close-on-exec, other children don't inherit them.
+ *
  * Returns pid.
  */
 #define fork_execv_on_steroids libreport_fork_execv_on_steroids
@@ -338,6 +376,14 @@ pid_t fork_execv_on_steroids(int flags,
                 char **env_vec,
                 const char *dir,
                 uid_t uid);
+/* Splits the shell command into words if it can be executed without shell,
+ * i.e. if it is a single command without quotes, expansions, redirections,
+ * variable assignments and shell builtins.
+ * Returns NULL if shell is needed, else a vector to be freed by
+ * string_vector_free().
+ */
+#define split_shell_command libreport_split_shell_command
+char **split_shell_command(const char *cmd);
 /* Returns malloc'ed string. NULs are retained, and extra one is appended
  * after the last byte (this NUL is not accounted for in *size_p) */
 #define run_in_shell_and_save_output libreport_run_in_shell_and_save_output
@@ -931,6 +977,13 @@ void parse_release_for_rhts(const char *pRelease, char **product, char **version
  */
 #define load_conf_file libreport_load_conf_file
 bool load_conf_file(const char *pPath, map_string_t *settings, bool skipKeysWithoutValue);
+/* Loads more files at once, it is faster than loading them one by one.
+ * @param paths NULL terminated list of the files
+ * @param settings settings[i] receives the options from paths[i]
+ * @return false if any of the files couldn't be loaded
+ */
+#define load_conf_files libreport_load_conf_files
+bool load_conf_files(const char *const *paths, map_string_t *const *settings, bool skipKeysWithoutValue);
 #define load_plugin_conf_file libreport_load_plugin_conf_file
 bool load_plugin_conf_file(const char *name, map_string_t *settings, bool skipKeysWithoutValue);
 
@@ -1138,6 +1191,8 @@ struct dump_dir *open_directory_for_writing(
  */
 #define FILENAME_REPORTED_TO  "reported_to"
 #define FILENAME_EVENT_LOG    "event_log"
+/* JSON lines with resources used by event commands, see run_event_state */
+#define FILENAME_EVENT_STATS  "event_stats"
 /*
  * If exists, should contain a full sentence (with trailing period)
  * which describes why this problem should not be reported.
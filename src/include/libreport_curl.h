@@ -156,6 +156,32 @@ char *upload_file_ext(post_state_t *post_state,
                 const char *filename,
                 int flags);
 
+/* Writes the data to be uploaded to fd, returns 0 on success.
+ * Runs in a separate thread. The fd must not be closed.
+ */
+typedef int (*upload_stream_producer_t)(int fd, void *args);
+
+/* Uploads the data written by producer to url without storing them anywhere.
+ *
+ * Works like upload_file_ext() but the filename does not need to exist and is
+ * only used to build the remote name. The data are uploaded while producer is
+ * still writing them, so their size is not known in advance and the protocol
+ * must support that (e.g. scp does not). The producer is called again if the
+ * upload is re-tried with new credentials.
+ *
+ * The upload fails if producer fails.
+ *
+ * @return Resulting URL on success (the URL does not contain userinfo);
+ * otherwise NULL.
+ */
+#define upload_stream_ext libreport_upload_stream_ext
+char *upload_stream_ext(post_state_t *post_state,
+                const char *url,
+                const char *filename,
+                upload_stream_producer_t producer,
+                void *args,
+                int flags);
+
 #ifdef __cplusplus
 }
 #endif
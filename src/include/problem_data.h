@@ -44,6 +44,11 @@ enum {
      * to a bug report etc.
      */
     CD_FLAG_BIGTXT        = (1 << 6),
+    /* The item was registered by a lazy load (PROBLEM_DATA_LOAD_LAZILY) and
+     * its content has not been read yet. Such item has NULL content and none
+     * of the other flags. See problem_item_load().
+     */
+    CD_FLAG_UNLOADED      = (1 << 7),
 };
 
 #define PROBLEM_ITEM_UNINITIALIZED_SIZE ((unsigned long)-1)
@@ -99,14 +104,28 @@ void problem_data_add_text_editable(problem_data_t *problem_data,
 /* "name" can be NULL: */
 void problem_data_add_file(problem_data_t *pd, const char *name, const char *path);
 
-static inline struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key)
-{
-    return (struct problem_item *)g_hash_table_lookup(problem_data, key);
-}
+/* Loads the item if it has not been loaded yet (see CD_FLAG_UNLOADED).
+ * Returns NULL if the item does not exist or cannot be loaded.
+ */
+struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key);
 char *problem_data_get_content_or_NULL(problem_data_t *problem_data, const char *key);
 /* Aborts if key is not found: */
 char *problem_data_get_content_or_die(problem_data_t *problem_data, const char *key);
 
+/* Reads the content of an item registered by a lazy load
+ *
+ * Code iterating over problem_data directly must call this function for every
+ * item it accesses, unless the problem data were loaded eagerly.
+ *
+ * The function waits for writers of other processes to unlock the dump
+ * directory, hence the caller must not hold the directory opened with
+ * DD_OPEN_SHARED meanwhile.
+ *
+ * @return 0 if the item is loaded (also if it was loaded before); otherwise
+ * a negative errno value, the item stays unloaded.
+ */
+int problem_item_load(struct problem_item *item);
+
 /* Returns all element names stored in problem_data */
 static inline GList *problem_data_get_all_elements(problem_data_t *problem_data)
 {
@@ -148,9 +167,30 @@ int problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, ch
 
 void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding);
 
+enum {
+    /* Only register the elements and read their contents when they are
+     * requested via problem_data_get_item_or_NULL(),
+     * problem_data_get_content_or_NULL() or problem_item_load(). The dump
+     * directory does not have to stay opened, each item opens it again with
+     * DD_OPEN_SHARED while reading its content and fails to load if the
+     * directory has been replaced meanwhile. The directory is not locked
+     * between the loads, hence the items hold the contents of the time they
+     * are loaded.
+     */
+    PROBLEM_DATA_LOAD_LAZILY = (1 << 0),
+};
+
+/* Works like problem_data_load_from_dump_dir() but accepts flags
+ *
+ * @param flags PROBLEM_DATA_LOAD_LAZILY or 0
+ */
+void problem_data_load_from_dump_dir_ext(problem_data_t *problem_data, struct dump_dir *dd,
+        char **excluding, int flags);
+
 problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd);
 /* Helper for typical operation in reporters: */
 problem_data_t *create_problem_data_for_reporting(const char *dump_dir_name);
+problem_data_t *create_problem_data_for_reporting_ext(const char *dump_dir_name, int flags);
 
 /**
   @brief Saves the problem data object
@@ -0,0 +1,113 @@
+/*
+    Copyright (C) 2016  ABRT team
+    Copyright (C) 2016  RedHat Inc
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+/* In-process reporters
+ *
+ * A reporter program can be also built as a shared object installed in
+ * PLUGINS_LIB_DIR/reporters. run_event_on_problem_data() then calls the
+ * plugin directly with the already loaded problem data instead of writing
+ * them to a dump directory and executing the program. The program remains
+ * the way to run the reporter from everywhere else.
+ *
+ * The shared object exports a struct reporter_plugin named
+ * REPORTER_PLUGIN_SYMBOL:
+ *
+ * const struct reporter_plugin libreport_reporter_plugin = {
+ *     .abi_version = REPORTER_PLUGIN_ABI_VERSION,
+ *     .name = "reporter-print",
+ *     .report = print_problem,
+ * };
+ */
+#ifndef LIBREPORT_REPORTER_PLUGIN_H_
+#define LIBREPORT_REPORTER_PLUGIN_H_
+
+#include "problem_data.h"
+#include "run_event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define REPORTER_PLUGIN_ABI_VERSION 1
+#define REPORTER_PLUGIN_SYMBOL "libreport_reporter_plugin"
+
+struct reporter_plugin {
+    /* REPORTER_PLUGIN_ABI_VERSION the plugin was built with */
+    unsigned abi_version;
+
+    /* Name of the program the plugin replaces, e.g. "reporter-print" */
+    const char *name;
+
+    /*
+     * Reports the problem. Runs in the process of the caller, so it must not
+     * exit or die, and must not change stdin and stdout.
+     *
+     * @param argc, argv The command line of the program from the event rule,
+     *        with argv[0] being the program
+     * @param problem_data The problem to report. The plugin can modify it,
+     *        e.g. add FILENAME_REPORTED_TO.
+     * @param settings The options of the event (as exported by
+     *        export_event_config()), the environment is the same as the
+     *        program would get
+     * @param state Questions are asked and messages are logged by the
+     *        callbacks of the state
+     * @return The exit code the program would return
+     */
+    int (*report)(int argc, char **argv,
+                  problem_data_t *problem_data,
+                  map_string_t *settings,
+                  struct run_event_state *state);
+};
+
+/*
+ * Returns the plugin replacing the program, or NULL if there is none.
+ *
+ * The plugins are loaded on the first call from PLUGINS_LIB_DIR/reporters,
+ * or from $LIBREPORT_REPORTER_PLUGINS_DIR if set. An empty
+ * $LIBREPORT_REPORTER_PLUGINS_DIR disables the plugins. The variable is
+ * ignored in setuid/setgid programs (see secure_getenv(3)).
+ *
+ * The plugin replaces the program installed in BIN_DIR only: a name which
+ * $PATH resolves to the installed program, or its absolute path. Programs
+ * of the same name elsewhere, e.g. local wrappers, are always executed.
+ * $LIBREPORT_REPORTER_PROGRAMS_DIR replaces BIN_DIR like the variable above.
+ *
+ * @param program Name or path of the program
+ */
+#define find_reporter_plugin libreport_find_reporter_plugin
+const struct reporter_plugin *find_reporter_plugin(const char *program);
+
+/*
+ * Calls the plugin as if it was run by the event rule
+ *
+ * @param argv NULL terminated command line
+ * @return The value returned by the plugin
+ */
+#define run_reporter_plugin libreport_run_reporter_plugin
+int run_reporter_plugin(const struct reporter_plugin *plugin,
+                        char **argv,
+                        problem_data_t *problem_data,
+                        const char *event,
+                        struct run_event_state *state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
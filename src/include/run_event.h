@@ -19,6 +19,8 @@
 #ifndef LIBREPORT_RUN_EVENT_H_
 #define LIBREPORT_RUN_EVENT_H_
 
+#include <regex.h>
+#include <time.h>
 #include "problem_data.h"
 
 #ifdef __cplusplus
@@ -26,6 +28,21 @@ extern "C" {
 #endif
 
 struct dump_dir;
+struct rule_index;
+struct condition_cache;
+
+/* Resources used by a finished event command */
+struct run_event_command_stats {
+    char *event;
+    char *command;
+    int status;          /* as returned by waitpid() */
+    double wall_time;    /* seconds from start to exit */
+    double user_time;    /* seconds of CPU time in user mode */
+    double system_time;  /* seconds of CPU time in kernel */
+    long max_rss;        /* peak resident set size in KiB */
+    unsigned long long output_bytes;
+    unsigned prompts;    /* number of answered ASK* requests */
+};
 
 struct run_event_state {
     int children_count;
@@ -137,12 +154,58 @@ struct run_event_state {
     char *(*ask_password_callback)(const char *msg, void *interaction_param);
 
     /* Internal data for async command execution */
-    GList *rule_list;
+    GList *rule_list; /* candidate rules for the event, owned by rule_index */
     pid_t command_pid;
     int command_out_fd;
     int command_in_fd;
     int process_status;
     struct strbuf *command_output;
+
+    /* The members below were added later, keep adding at the end to stay
+     * compatible with the programs built against older versions.
+     */
+
+    /* The maximum number of commands run_event_on_dir_name() runs
+     * concurrently if the rules allow it. Defaults to the number of CPUs.
+     */
+    unsigned max_concurrent_commands;
+
+    /* Rules used instead of loading report_event.conf in every
+     * prepare_commands(), e.g. by rule_index_load(). Can be shared by many
+     * states and isn't freed with the state.
+     */
+    struct rule_index *shared_rule_index;
+
+    /*
+     * Called when a command finished, before post_run_callback.
+     *
+     * @param stats The resources used by the command, valid only during the
+     *        call
+     * @param param command_stats_param
+     */
+    void (*command_stats_callback)(const struct run_event_command_stats *stats, void *param);
+    void *command_stats_param;
+
+    /* Append the stats of every command as a JSON line to FILENAME_EVENT_STATS
+     * in the dump directory. The lines are written when no command of the
+     * event runs anymore, by run_event_on_*() or free_commands(). Defaults to
+     * true if $LIBREPORT_EVENT_STATS is set.
+     */
+    bool log_command_stats;
+
+    /* NULL terminated vector of "NAME=value" strings added to the environment
+     * of the commands, e.g. get_event_config_env_vec(). Not freed with the
+     * state.
+     */
+    char **env_vec;
+
+    /* Internal data for async command execution */
+    struct rule_index *rule_index; /* loaded by prepare_commands() */
+    struct condition_cache *condition_cache; /* values of dump dir elements */
+    struct run_event_command_stats command_stats;
+    struct timespec command_start;
+    struct strbuf *command_stats_lines; /* not written to the dump dir yet */
+    char *command_stats_dump_dir_name;
 };
 struct run_event_state *new_run_event_state(void);
 void free_run_event_state(struct run_event_state *state);
@@ -156,9 +219,38 @@ void make_run_event_state_forwarding(struct run_event_state *state);
 
 
 /* Asynchronous command execution */
+
+/* Operators of rule conditions */
+enum {
+    RULE_COND_EQ,    /* VAR=VAL */
+    RULE_COND_NE,    /* VAR!=VAL */
+    RULE_COND_REGEX, /* VAR~=REGEX */
+    RULE_COND_EVENT, /* EVENT=VAL, matched against the event name */
+};
+
+struct rule_condition {
+    char *name;  /* "EVENT" or name of a problem element */
+    char *value;
+    int op;      /* RULE_COND_* */
+    regex_t *regex; /* compiled VAR~=REGEX, NULL if REGEX is invalid */
+};
+
 struct rule {
-    GList *conditions;
+    GList *conditions; /* "VAR=VAL" words as written in the configuration */
     char *command; /* never NULL */
+
+    /* The conditions split into (var, operator, value) triples */
+    struct rule_condition *cond_vec;
+    unsigned cond_count;
+    /* Value of the first EVENT= condition or NULL */
+    const char *event;
+    /* Position of the rule in the list returned by load_rule_list() */
+    unsigned order;
+
+    /* Scheduling annotations, see run_event_on_dir_name() */
+    bool annotated; /* the rule has ID= or AFTER= */
+    char *id;       /* value of ID= or NULL */
+    GList *after;   /* IDs from AFTER= */
 };
 
 /* Returns 0 if no commands found for this dump_dir_name+event, else >0 */
@@ -168,6 +260,10 @@ int prepare_commands(struct run_event_state *state, const char *dump_dir_name, c
  * else sets state->command_pid and state->command_out_fd and returns >=0.
  * execflags can be e.g. EXECFLG_SETPGID to put the event handling process
  * into a new process group, EXECFLG_SETSID to put it in a new session, etc.
+ *
+ * The commands are returned one after another in the configuration order,
+ * ID= and AFTER= are ignored (AFTER= names only earlier rules, so the order
+ * satisfies them).
  */
 int spawn_next_command(struct run_event_state *state,
                 const char *dump_dir_name,
@@ -184,9 +280,32 @@ void free_commands(struct run_event_state *state);
  */
 GList *load_rule_list(GList *rule_list, const char *conf_file_name, unsigned recursion_depth);
 
+/* Same as load_rule_list(NULL, conf_file_name, 0) but the rules are loaded
+ * from a cache in $XDG_CACHE_HOME/libreport/rules/ if none of the files
+ * they were parsed from has changed. The cache is updated otherwise.
+ * The cache is not used by root and by setuid/setgid processes.
+ */
+GList *load_rule_list_cached(const char *conf_file_name);
+
 /* Cleans up rule list created by load_rule_list */
 void free_rule_list(GList *rule_list);
 
+/* Index of rules keyed by event name.
+ * Takes ownership of the rule_list returned by load_rule_list().
+ */
+struct rule_index *rule_index_new(GList *rule_list);
+/* Index of the rules from report_event.conf, loaded through the cache */
+struct rule_index *rule_index_load(void);
+void rule_index_free(struct rule_index *index);
+/* Return the rules which can match the event, in configuration order.
+ * Rules without EVENT= condition match every event.
+ * The returned list must be released by g_list_free(), the rules are owned by
+ * the index.
+ */
+GList *rule_index_lookup(struct rule_index *index, const char *event);
+/* Same as above but for all events starting with pfx */
+GList *rule_index_lookup_prefix(struct rule_index *index, const char *pfx);
+
 /* Synchronous command execution */
 
 /* The function believes that a state param value is fully initialized and
@@ -203,10 +322,67 @@ int consume_event_command_output(struct run_event_state *state, const char *dump
 
 /* Returns exit code of first failed action, or first nonzero return value
  * of post_run_callback. If all actions are successful, returns 0.
+ *
+ * Commands of rules annotated with ID= or AFTER= run concurrently, see
+ * report_event.conf(5). No command is started after the first failure.
+ * The callbacks of the state are called from the calling thread one at a
+ * time, but the other commands keep running while a question is being
+ * answered; their output is processed after the answer.
  */
 int run_event_on_dir_name(struct run_event_state *state, const char *dump_dir_name, const char *event);
 int run_event_on_problem_data(struct run_event_state *state, problem_data_t *data, const char *event);
 
+/* Event loop driving many run_event_states from one thread
+ *
+ * Every added state runs the commands of an event on its dump directory
+ * one after another, as run_event_on_dir_name() does for rules without
+ * annotations, while the output of the commands of all states is read as
+ * it comes.
+ */
+struct run_event_loop;
+
+/*
+ * Called when the last command of the event finished or the first one failed
+ *
+ * @param state The state passed to run_event_loop_add()
+ * @param dump_dir_name The dump directory passed to run_event_loop_add()
+ * @param retval Same as the return value of run_event_on_dir_name()
+ * @param param The param passed to run_event_loop_add()
+ */
+typedef void (*run_event_done_callback)(struct run_event_state *state,
+                                        const char *dump_dir_name,
+                                        int retval,
+                                        void *param);
+
+struct run_event_loop *run_event_loop_new(void);
+/* Running commands are not killed, their states are released without
+ * waiting for them. */
+void run_event_loop_free(struct run_event_loop *loop);
+
+/*
+ * Starts running the event on the dump directory. The state must not be used
+ * for anything else until done_callback is called; then it can be added
+ * again. done_callback is always called from run_event_loop_iterate(), even if
+ * no command is configured for the event, and can add new states.
+ */
+void run_event_loop_add(struct run_event_loop *loop,
+                        struct run_event_state *state,
+                        const char *dump_dir_name,
+                        const char *event,
+                        run_event_done_callback done_callback,
+                        void *param);
+
+/*
+ * Waits at most timeout milliseconds (-1 means infinity) for output of the
+ * running commands and processes it.
+ *
+ * @return The number of states which haven't been finished yet
+ */
+unsigned run_event_loop_iterate(struct run_event_loop *loop, int timeout);
+
+/* Iterates until all added states are finished */
+void run_event_loop_run(struct run_event_loop *loop);
+
 
 /* Querying for possible events */
 
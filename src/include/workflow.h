@@ -79,6 +79,12 @@ int wf_priority_compare(const workflow_t *first, const workflow_t *second);
  */
 GHashTable *load_workflow_config_data_from_list(GList *wf_names, const char *path);
 
+/* Loads the workflow from WORKFLOWS_DIR again and replaces it in
+ * g_workflow_list, or removes it if its file does not exist anymore.
+ * Does nothing if g_workflow_list has not been loaded.
+ */
+void reload_workflow_config(const char *name);
+
 /* The function loads all workflow XML configuration files placed in the given
  * directory.
  *
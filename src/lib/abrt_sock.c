@@ -96,6 +96,9 @@ int problem_data_send_to_abrt(problem_data_t* problem_data)
         full_write(socketfd, "PUT / HTTP/1.1\r\n\r\n", strlen("PUT / HTTP/1.1\r\n\r\n"));
         while (g_hash_table_iter_next(&iter, (void**)&name, (void**)&value))
         {
+            if (problem_item_load(value) != 0)
+                continue;
+
             if (value->flags & CD_FLAG_BIN)
             {
                 /* sending files over the socket is not implemented yet */
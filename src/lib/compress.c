@@ -21,13 +21,25 @@
 #if HAVE_LZMA
 # include <lzma.h>
 #else
-# define LR_DECOMPRESS_FORK_EXECVP
+# define LR_FORK_EXECVP
 #endif
 
 #if HAVE_LZ4
 # include <lz4frame.h>
 #else
-# define LR_DECOMPRESS_FORK_EXECVP
+# define LR_FORK_EXECVP
+#endif
+
+#if HAVE_ZLIB
+# include <zlib.h>
+#else
+# define LR_FORK_EXECVP
+#endif
+
+#if HAVE_ZSTD
+# include <zstd.h>
+#else
+# define LR_FORK_EXECVP
 #endif
 
 static const uint8_t s_xz_magic[6] = { 0xFD, 0x37, 0x7A, 0x58, 0x5A, 0x00 };
@@ -46,14 +58,14 @@ is_format(const char *name, const uint8_t *header, size_t hl, const uint8_t *mag
 }
 
 
-#ifdef LR_DECOMPRESS_FORK_EXECVP
+#ifdef LR_FORK_EXECVP
 static int
-decompress_using_fork_execvp(const char** cmd, int fdi, int fdo)
+filter_using_fork_execvp(const char** cmd, int fdi, int fdo)
 {
     pid_t child = fork();
     if (child < 0)
     {
-        VERB1 perror_msg("fork() for decompression");
+        VERB1 perror_msg("fork() for '%s'", cmd[0]);
         return -1;
     }
 
@@ -62,20 +74,20 @@ decompress_using_fork_execvp(const char** cmd, int fdi, int fdo)
         close(STDIN_FILENO);
         if (dup2(fdi, STDIN_FILENO) < 0)
         {
-            VERB1 perror_msg("Decompression failed: dup2(fdi, STDIN_FILENO)");
+            VERB1 perror_msg("'%s' failed: dup2(fdi, STDIN_FILENO)", cmd[0]);
             exit(EXIT_FAILURE);
         }
 
         close(STDOUT_FILENO);
         if (dup2(fdo, STDOUT_FILENO) < 0)
         {
-            VERB1 perror_msg("Decompression failed: dup2(fdo, STDOUT_FILENO)");
+            VERB1 perror_msg("'%s' failed: dup2(fdo, STDOUT_FILENO)", cmd[0]);
             exit(EXIT_FAILURE);
         }
 
         execvp(cmd[0], (char **)cmd);
 
-        VERB1 perror_msg("Decompression failed: execlp('%s')", cmd[0]);
+        VERB1 perror_msg("'%s' failed: execvp()", cmd[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -83,19 +95,19 @@ decompress_using_fork_execvp(const char** cmd, int fdi, int fdo)
     int r = safe_waitpid(child, &status, 0);
     if (r < 0)
     {
-        VERB1 perror_msg("Decompression failed: waitpid($1) failed");
+        VERB1 perror_msg("'%s' failed: waitpid() failed", cmd[0]);
         return -2;
     }
 
     if (!WIFEXITED(status))
     {
-        log_info("Decompression process returned abnormally");
+        log_info("'%s' process returned abnormally", cmd[0]);
         return -3;
     }
 
     if (WEXITSTATUS(status) != 0)
     {
-        log_info("Decompression process exited with %d", WEXITSTATUS(r));
+        log_info("'%s' process exited with %d", cmd[0], WEXITSTATUS(status));
         return -4;
     }
 
@@ -173,7 +185,7 @@ decompress_fd_xz(int fdi, int fdo)
     return 0;
 #else /*HAVE_LZMA*/
     const char *cmd[] = { "xzcat", "-d", "-", NULL };
-    return decompress_using_fork_execvp(cmd, fdi, fdo);
+    return filter_using_fork_execvp(cmd, fdi, fdo);
 #endif /*HAVE_LZMA*/
 }
 
@@ -258,7 +270,7 @@ cleanup:
     return r;
 #else /*HAVE_LZ4*/
     const char *cmd[] = { "lz4", "-cd", "-", NULL};
-    return decompress_using_fork_execvp(cmd, fdi, fdo);
+    return filter_using_fork_execvp(cmd, fdi, fdo);
 #endif /*HAVE_LZ4*/
 }
 
@@ -327,3 +339,387 @@ int decompress_file(const char *path_in, const char *path_out, mode_t mode_out)
     return decompress_file_ext_at(path_in, AT_FDCWD, path_out, mode_out, -1, -1,
             O_RDONLY, O_WRONLY | O_CREAT | O_EXCL | O_TRUNC);
 }
+
+static unsigned
+compression_threads(void)
+{
+    const long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+#if HAVE_ZLIB
+/* The input is split to blocks which are compressed in parallel to separate
+ * gzip members. A concatenation of gzip members is a valid gzip file, gzip -d
+ * and zlib (inflateInit2 + inflateReset on Z_STREAM_END) decompress it as
+ * a single stream.
+ */
+enum { GZIP_BLOCK_SIZE = 1024*1024 };
+
+struct gzip_block
+{
+    uint8_t *in;
+    size_t in_size;
+    uint8_t *out;
+    size_t out_size;
+    int status;
+    bool done;
+    GMutex lock;
+    GCond cond;
+};
+
+static void
+gzip_block_free(struct gzip_block *block)
+{
+    free(block->in);
+    free(block->out);
+    g_mutex_clear(&block->lock);
+    g_cond_clear(&block->cond);
+    free(block);
+}
+
+static void
+gzip_block_compress(gpointer data, gpointer user_data)
+{
+    struct gzip_block *block = data;
+
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    /* 15 + 16: the largest window with gzip header and trailer */
+    int r = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY);
+    if (r == Z_OK)
+    {
+        block->out_size = deflateBound(&strm, block->in_size);
+        block->out = xmalloc(block->out_size);
+
+        strm.next_in = block->in;
+        strm.avail_in = block->in_size;
+        strm.next_out = block->out;
+        strm.avail_out = block->out_size;
+
+        r = deflate(&strm, Z_FINISH);
+        r = (r == Z_STREAM_END) ? Z_OK : Z_BUF_ERROR;
+        block->out_size = strm.total_out;
+
+        deflateEnd(&strm);
+    }
+
+    g_mutex_lock(&block->lock);
+    block->status = r;
+    block->done = true;
+    g_cond_signal(&block->cond);
+    g_mutex_unlock(&block->lock);
+}
+#endif /*HAVE_ZLIB*/
+
+static int
+compress_fd_gzip(int fdi, int fdo)
+{
+#if HAVE_ZLIB
+    const unsigned threads = compression_threads();
+    GThreadPool *pool = g_thread_pool_new(gzip_block_compress, NULL, threads, FALSE, NULL);
+    GQueue pending = G_QUEUE_INIT;
+    unsigned blocks = 0;
+    bool eof = false;
+    int r = 0;
+
+    while (r == 0 && (!eof || !g_queue_is_empty(&pending)))
+    {
+        /* Keep all threads busy, but don't read the whole input in memory */
+        if (!eof && g_queue_get_length(&pending) < 2 * threads)
+        {
+            struct gzip_block *block = xzalloc(sizeof(*block));
+            g_mutex_init(&block->lock);
+            g_cond_init(&block->cond);
+            block->in = xmalloc(GZIP_BLOCK_SIZE);
+
+            const ssize_t rd = full_read(fdi, block->in, GZIP_BLOCK_SIZE);
+            if (rd < 0)
+            {
+                perror_msg("Failed to read data for compression");
+                gzip_block_free(block);
+                r = -1;
+                break;
+            }
+
+            /* full_read() returns less than requested only at EOF */
+            eof = rd < GZIP_BLOCK_SIZE;
+
+            /* Empty input must result in a valid gzip file too */
+            if (rd == 0 && blocks != 0)
+            {
+                gzip_block_free(block);
+                continue;
+            }
+
+            block->in_size = rd;
+            ++blocks;
+            g_queue_push_tail(&pending, block);
+            g_thread_pool_push(pool, block, NULL);
+            continue;
+        }
+
+        /* Write the blocks in the order they were read */
+        struct gzip_block *block = g_queue_pop_head(&pending);
+        g_mutex_lock(&block->lock);
+        while (!block->done)
+            g_cond_wait(&block->cond, &block->lock);
+        g_mutex_unlock(&block->lock);
+
+        if (block->status != Z_OK)
+        {
+            error_msg("Failed to compress data: zlib error %d", block->status);
+            r = -1;
+        }
+        else if (full_write(fdo, block->out, block->out_size) != block->out_size)
+        {
+            perror_msg("Failed to write compressed data");
+            r = -1;
+        }
+
+        gzip_block_free(block);
+    }
+
+    /* Wait for the blocks being compressed before freeing them */
+    g_thread_pool_free(pool, /*immediate*/FALSE, /*wait*/TRUE);
+    g_queue_foreach(&pending, (GFunc)gzip_block_free, NULL);
+    g_queue_clear(&pending);
+
+    return r;
+#else /*HAVE_ZLIB*/
+    const char *cmd[] = { "gzip", "-c", NULL };
+    return filter_using_fork_execvp(cmd, fdi, fdo);
+#endif /*HAVE_ZLIB*/
+}
+
+static int
+compress_fd_zstd(int fdi, int fdo)
+{
+#if HAVE_ZSTD
+    ZSTD_CCtx *cctx = ZSTD_createCCtx();
+    if (cctx == NULL)
+    {
+        log_error("Failed to initialize ZSTD encoder");
+        return -ENOMEM;
+    }
+
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, ZSTD_CLEVEL_DEFAULT);
+    /* Fails if libzstd was built without multithreading support, the data
+     * are then compressed in the calling thread. */
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, compression_threads());
+
+    const size_t in_size = ZSTD_CStreamInSize();
+    const size_t out_size = ZSTD_CStreamOutSize();
+    uint8_t *buf_in = xmalloc(in_size);
+    uint8_t *buf_out = xmalloc(out_size);
+    int r = 0;
+
+    for (;;)
+    {
+        const ssize_t rd = full_read(fdi, buf_in, in_size);
+        if (rd < 0)
+        {
+            perror_msg("Failed to read data for compression");
+            r = -1;
+            break;
+        }
+
+        /* full_read() returns less than requested only at EOF */
+        const ZSTD_EndDirective mode = (size_t)rd < in_size ? ZSTD_e_end : ZSTD_e_continue;
+        ZSTD_inBuffer input = { buf_in, rd, 0 };
+        bool finished;
+        do
+        {
+            ZSTD_outBuffer output = { buf_out, out_size, 0 };
+            const size_t remaining = ZSTD_compressStream2(cctx, &output, &input, mode);
+            if (ZSTD_isError(remaining))
+            {
+                error_msg("Failed to compress data: %s", ZSTD_getErrorName(remaining));
+                r = -1;
+                goto finito;
+            }
+
+            if (full_write(fdo, buf_out, output.pos) != output.pos)
+            {
+                perror_msg("Failed to write compressed data");
+                r = -1;
+                goto finito;
+            }
+
+            finished = (mode == ZSTD_e_end) ? remaining == 0 : input.pos == input.size;
+        }
+        while (!finished);
+
+        if (mode == ZSTD_e_end)
+            break;
+    }
+
+finito:
+    free(buf_in);
+    free(buf_out);
+    ZSTD_freeCCtx(cctx);
+    return r;
+#else /*HAVE_ZSTD*/
+    const char *cmd[] = { "zstd", "-T0", "-q", "-c", NULL };
+    return filter_using_fork_execvp(cmd, fdi, fdo);
+#endif /*HAVE_ZSTD*/
+}
+
+static int
+compress_fd_xz(int fdi, int fdo)
+{
+#if HAVE_LZMA
+    uint8_t buf_in[BUFSIZ];
+    uint8_t buf_out[BUFSIZ];
+
+    lzma_mt mt;
+    memset(&mt, 0, sizeof(mt));
+    mt.threads = compression_threads();
+    mt.preset = LZMA_PRESET_DEFAULT;
+    mt.check = LZMA_CHECK_CRC64;
+
+    lzma_stream strm = LZMA_STREAM_INIT;
+    lzma_ret ret = lzma_stream_encoder_mt(&strm, &mt);
+    if (ret != LZMA_OK)
+    {
+        log_error("Failed to initialize XZ encoder: code %d", ret);
+        return -ENOMEM;
+    }
+
+    lzma_action action = LZMA_RUN;
+
+    strm.next_out = buf_out;
+    strm.avail_out = sizeof(buf_out);
+
+    for (;;)
+    {
+        if (strm.avail_in == 0 && action == LZMA_RUN)
+        {
+            const ssize_t rd = safe_read(fdi, buf_in, sizeof(buf_in));
+            if (rd < 0)
+            {
+                perror_msg("Failed to read data for compression");
+                lzma_end(&strm);
+                return -1;
+            }
+
+            strm.next_in = buf_in;
+            strm.avail_in = rd;
+
+            if (rd == 0)
+                action = LZMA_FINISH;
+        }
+
+        ret = lzma_code(&strm, action);
+        if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+        {
+            error_msg("Failed to compress data: code %d", ret);
+            lzma_end(&strm);
+            return -1;
+        }
+
+        if (strm.avail_out == 0 || ret == LZMA_STREAM_END)
+        {
+            const ssize_t n = sizeof(buf_out) - strm.avail_out;
+            if (n != full_write(fdo, buf_out, n))
+            {
+                perror_msg("Failed to write compressed data");
+                lzma_end(&strm);
+                return -1;
+            }
+
+            if (ret == LZMA_STREAM_END)
+                break;
+
+            strm.next_out = buf_out;
+            strm.avail_out = sizeof(buf_out);
+        }
+    }
+
+    lzma_end(&strm);
+    return 0;
+#else /*HAVE_LZMA*/
+    const char *cmd[] = { "xz", "-T0", "-c", NULL };
+    return filter_using_fork_execvp(cmd, fdi, fdo);
+#endif /*HAVE_LZMA*/
+}
+
+int
+compress_fd(libreport_compression_format format, int fdi, int fdo)
+{
+    switch (format)
+    {
+        case COMPRESSION_GZIP:
+            return compress_fd_gzip(fdi, fdo);
+        case COMPRESSION_ZSTD:
+            return compress_fd_zstd(fdi, fdo);
+        case COMPRESSION_XZ:
+            return compress_fd_xz(fdi, fdo);
+    }
+
+    error_msg("Unsupported compression format %d", format);
+    return -ENOSYS;
+}
+
+int
+archive_compression_format(const char *archive_name)
+{
+    if (suffixcmp(archive_name, ".tar.gz") == 0)
+        return COMPRESSION_GZIP;
+
+    if (suffixcmp(archive_name, ".tar.zst") == 0)
+        return COMPRESSION_ZSTD;
+
+    if (suffixcmp(archive_name, ".tar.xz") == 0)
+        return COMPRESSION_XZ;
+
+    return -ENOSYS;
+}
+
+struct compressor
+{
+    libreport_compression_format format;
+    int fdi;
+    int fdo;
+    GThread *thread;
+};
+
+static gpointer
+compressor_thread(gpointer data)
+{
+    struct compressor *compressor = data;
+    const int r = compress_fd(compressor->format, compressor->fdi, compressor->fdo);
+
+    /* Writers get EPIPE instead of blocking forever if we failed */
+    close(compressor->fdi);
+
+    return GINT_TO_POINTER(r);
+}
+
+int
+compressor_start(libreport_compression_format format, int fdo, struct compressor **compressor)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0)
+    {
+        const int r = -errno;
+        perror_msg("Can't create a pipe for compression");
+        return r;
+    }
+
+    struct compressor *c = xzalloc(sizeof(*c));
+    c->format = format;
+    c->fdi = pipefd[0];
+    c->fdo = fdo;
+    c->thread = g_thread_new("compressor", compressor_thread, c);
+
+    *compressor = c;
+    return pipefd[1];
+}
+
+int
+compressor_finish(struct compressor *compressor)
+{
+    const int r = GPOINTER_TO_INT(g_thread_join(compressor->thread));
+    free(compressor);
+    return r;
+}
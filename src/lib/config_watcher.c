@@ -0,0 +1,288 @@
+/*
+    Copyright (C) 2016  ABRT team
+    Copyright (C) 2016  RedHat Inc
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <sys/inotify.h>
+#include "internal_libreport.h"
+#include "workflow.h"
+#include "global_configuration.h"
+#include "config_watcher.h"
+
+#define GLOBAL_CONF_FILE_NAME "libreport.conf"
+
+/* Created, replaced (e.g. by an editor saving to a temporary file and
+ * renaming it) or removed files */
+#define CONFIG_WATCHER_MASK (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+struct config_watch
+{
+    int wd;
+    enum config_watcher_item item;
+    const char *suffix; /* of the files of the items */
+};
+
+struct config_watcher
+{
+    int fd;
+    config_watcher_callback callback;
+    void *param;
+    /* EVENTS_DIR, EVENTS_CONF_DIR, cache, WORKFLOWS_DIR, CONF_DIR, user conf */
+    struct config_watch watches[6];
+    unsigned watch_count;
+};
+
+static void add_config_watch(struct config_watcher *watcher,
+                const char *dir_name,
+                enum config_watcher_item item,
+                const char *suffix)
+{
+    const int wd = inotify_add_watch(watcher->fd, dir_name, CONFIG_WATCHER_MASK);
+    if (wd < 0)
+    {
+        /* The user's directories needn't exist */
+        if (errno == ENOENT)
+            log_info("Not watching '%s': %s", dir_name, strerror(errno));
+        else
+            perror_msg("Can't watch '%s'", dir_name);
+        return;
+    }
+
+    struct config_watch *watch = &watcher->watches[watcher->watch_count++];
+    watch->wd = wd;
+    watch->item = item;
+    watch->suffix = suffix;
+}
+
+struct config_watcher *config_watcher_new(config_watcher_callback callback, void *param)
+{
+    const int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0)
+    {
+        perror_msg("inotify_init1");
+        return NULL;
+    }
+
+    struct config_watcher *watcher = xzalloc(sizeof(*watcher));
+    watcher->fd = fd;
+    watcher->callback = callback;
+    watcher->param = param;
+
+    add_config_watch(watcher, EVENTS_DIR, CONFIG_WATCHER_EVENT, ".xml");
+    add_config_watch(watcher, EVENTS_CONF_DIR, CONFIG_WATCHER_EVENT, ".conf");
+
+    char *cachedir = concat_path_file(g_get_user_cache_dir(), "abrt/events");
+    add_config_watch(watcher, cachedir, CONFIG_WATCHER_EVENT, ".conf");
+    free(cachedir);
+
+    add_config_watch(watcher, WORKFLOWS_DIR, CONFIG_WATCHER_WORKFLOW, ".xml");
+    add_config_watch(watcher, CONF_DIR, CONFIG_WATCHER_GLOBAL, NULL);
+    add_config_watch(watcher, get_user_conf_base_dir(), CONFIG_WATCHER_GLOBAL, NULL);
+
+    return watcher;
+}
+
+void config_watcher_free(struct config_watcher *watcher)
+{
+    if (!watcher)
+        return;
+
+    /* Closing the descriptor removes the watches */
+    close(watcher->fd);
+    free(watcher);
+}
+
+int config_watcher_get_fd(struct config_watcher *watcher)
+{
+    return watcher->fd;
+}
+
+static const struct config_watch *find_config_watch(struct config_watcher *watcher, int wd)
+{
+    for (unsigned i = 0; i < watcher->watch_count; ++i)
+        if (watcher->watches[i].wd == wd)
+            return &watcher->watches[i];
+
+    return NULL;
+}
+
+/* Adds the name of the item the file belongs to, or sets *global */
+static void add_changed_file(const struct config_watch *watch,
+                const char *file_name,
+                GHashTable *changed[],
+                bool *global)
+{
+    if (watch->item == CONFIG_WATCHER_GLOBAL)
+    {
+        if (strcmp(file_name, GLOBAL_CONF_FILE_NAME) == 0)
+            *global = true;
+        return;
+    }
+
+    /* Skip the temporary files of editors etc. */
+    const size_t len = strlen(file_name);
+    const size_t suffix_len = strlen(watch->suffix);
+    if (len <= suffix_len || strcmp(file_name + len - suffix_len, watch->suffix) != 0)
+        return;
+
+    char *name = xstrndup(file_name, len - suffix_len);
+    g_hash_table_replace(changed[watch->item], name, name);
+}
+
+static void notify(struct config_watcher *watcher, enum config_watcher_item item, const char *name)
+{
+    if (watcher->callback)
+        watcher->callback(item, name, watcher->param);
+}
+
+/* The workflows contain the descriptions of their events */
+static void add_workflows_of_event(const char *event_name, GHashTable *workflows)
+{
+    GHashTableIter iter;
+    gpointer name;
+    gpointer workflow;
+    g_hash_table_iter_init(&iter, g_workflow_list);
+    while (g_hash_table_iter_next(&iter, &name, &workflow))
+    {
+        GList *event_names = wf_get_event_names(workflow);
+        if (g_list_find_custom(event_names, event_name, (GCompareFunc)strcmp))
+            g_hash_table_replace(workflows, xstrdup(name), xstrdup(name));
+        g_list_free_full(event_names, free);
+    }
+}
+
+/* Too many changes to tell which, the events were lost */
+static int reload_all_configuration(struct config_watcher *watcher)
+{
+    log_warning("Too many configuration changes, reloading all configuration");
+
+    int count = 0;
+    if (g_event_config_list)
+    {
+        load_event_config_data();
+        notify(watcher, CONFIG_WATCHER_EVENT, NULL);
+        ++count;
+    }
+
+    if (g_workflow_list)
+    {
+        g_hash_table_destroy(g_workflow_list);
+        g_workflow_list = NULL;
+        load_workflow_config_data(NULL);
+        notify(watcher, CONFIG_WATCHER_WORKFLOW, NULL);
+        ++count;
+    }
+
+    if (reload_global_configuration())
+    {
+        notify(watcher, CONFIG_WATCHER_GLOBAL, NULL);
+        ++count;
+    }
+
+    return count;
+}
+
+int config_watcher_process(struct config_watcher *watcher)
+{
+    GHashTable *changed[] = {
+        [CONFIG_WATCHER_EVENT] = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL),
+        [CONFIG_WATCHER_WORKFLOW] = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL),
+    };
+    bool global = false;
+    bool overflow = false;
+    int retval = 0;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1)
+    {
+        const ssize_t len = read(watcher->fd, buf, sizeof(buf));
+        if (len < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN)
+                break;
+
+            perror_msg("Can't read configuration changes");
+            retval = -1;
+            goto ret;
+        }
+
+        for (char *ptr = buf; ptr < buf + len; )
+        {
+            const struct inotify_event *event = (const struct inotify_event *)ptr;
+            ptr += sizeof(*event) + event->len;
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                overflow = true;
+                continue;
+            }
+
+            const struct config_watch *watch = find_config_watch(watcher, event->wd);
+            if (watch && event->len > 0)
+            {
+                log_debug("Configuration file '%s' changed", event->name);
+                add_changed_file(watch, event->name, changed, &global);
+            }
+        }
+    }
+
+    if (overflow)
+    {
+        retval = reload_all_configuration(watcher);
+        goto ret;
+    }
+
+    GHashTableIter iter;
+    gpointer name;
+    g_hash_table_iter_init(&iter, changed[CONFIG_WATCHER_EVENT]);
+    while (g_hash_table_iter_next(&iter, &name, NULL))
+    {
+        if (!g_event_config_list)
+            break;
+
+        reload_event_config(name);
+        notify(watcher, CONFIG_WATCHER_EVENT, name);
+        ++retval;
+
+        if (g_workflow_list)
+            add_workflows_of_event(name, changed[CONFIG_WATCHER_WORKFLOW]);
+    }
+
+    g_hash_table_iter_init(&iter, changed[CONFIG_WATCHER_WORKFLOW]);
+    while (g_hash_table_iter_next(&iter, &name, NULL))
+    {
+        if (!g_workflow_list)
+            break;
+
+        reload_workflow_config(name);
+        notify(watcher, CONFIG_WATCHER_WORKFLOW, name);
+        ++retval;
+    }
+
+    if (global && reload_global_configuration())
+    {
+        notify(watcher, CONFIG_WATCHER_GLOBAL, NULL);
+        ++retval;
+    }
+
+ ret:
+    g_hash_table_destroy(changed[CONFIG_WATCHER_EVENT]);
+    g_hash_table_destroy(changed[CONFIG_WATCHER_WORKFLOW]);
+
+    return retval;
+}
@@ -153,7 +153,7 @@ static void internal_aug_error_msg(augeas *aug, const char *def_msg)
  * node.
  */
 static bool
-internal_aug_init(augeas **aug, const char *path)
+internal_aug_init_files(augeas **aug, const char *const *paths, size_t count)
 {
     int aug_flag = AUG_NO_ERR_CLOSE /* without this flag aug_init() returns
                                      * NULL on errors and we cannot read the
@@ -184,11 +184,18 @@ internal_aug_init(augeas **aug, const char *path)
         return false;
     }
 
-    /* parse only this configuration file */
-    if (aug_set(*aug, "/augeas/load/Libreport/incl[1]", path) < 0)
+    /* parse only these configuration files */
+    for (size_t i = 0; i < count; ++i)
     {
-        internal_aug_error_msg(*aug, "Cannot configure augeas to read the configuration file");
-        return false;
+        char *incl = xasprintf("/augeas/load/Libreport/incl[%zu]", i + 1);
+        const int r = aug_set(*aug, incl, paths[i]);
+        free(incl);
+
+        if (r < 0)
+        {
+            internal_aug_error_msg(*aug, "Cannot configure augeas to read the configuration file");
+            return false;
+        }
     }
 
     if (aug_load(*aug) < 0)
@@ -201,6 +208,12 @@ internal_aug_init(augeas **aug, const char *path)
     return true;
 }
 
+static bool
+internal_aug_init(augeas **aug, const char *path)
+{
+    return internal_aug_init_files(aug, &path, 1);
+}
+
 enum {
     GAON_NO_FLAG = 0,   /* Explicit default value */
     GAON_FAIL_ON_NOENT, /* Fail if configuration file does not exist */
@@ -258,27 +271,145 @@ static bool internal_aug_get_all_option_names(augeas *aug, const char *real_path
     return true;
 }
 
-/* Returns false if any error occurs, else returns true.
+/* Parses a line of the Libreport lens (augeas/libreport.aug):
+ *
+ *   comment: '#' [ \t]* (VALUE)? '\n'
+ *   empty:   [ \t]* '\n'
+ *   option:  [ \t]* [a-zA-Z][a-zA-Z_]+ [ \t]* '=' [ \t]* (VALUE)? [ \t]* '\n'
+ *
+ * where VALUE starts and ends with a character other than ' ', '\t' and '\n'.
+ *
+ * The line is terminated by '\n' at end, the name and the value are
+ * terminated in place. *name is NULL for comments and empty lines.
+ *
+ * Returns false if the line does not match the lens.
  */
-bool load_conf_file(const char *path, map_string_t *settings, bool skipKeysWithoutValue)
+#define IS_CONF_KEY_ALPHA(c) (((c) >= 'a' && (c) <= 'z') || ((c) >= 'A' && (c) <= 'Z'))
+
+static bool parse_conf_line(char *line, char *end, char **name, char **value)
 {
-    bool retval = false;
-    char real_path[PATH_MAX + 1];
-    augeas *aug = NULL;
+    *name = NULL;
 
-    if (!canonicalize_path(path, real_path))
+    if (line[0] == '#')
     {
-        VERB3 perror_msg("Cannot get real path for '%s'", path);
-        goto finalize;
+        /* Trailing white space in a comment is not allowed by the lens */
+        return end == skip_blank(line + 1) || !isblank(end[-1]);
     }
 
-    if (!internal_aug_init(&aug, real_path))
+    char *p = skip_blank(line);
+    if (p == end)
+        return true;
+
+    char *key = p;
+    if (!IS_CONF_KEY_ALPHA(*p))
+        return false;
+    ++p;
+    while (IS_CONF_KEY_ALPHA(*p) || *p == '_')
+        ++p;
+    if (p - key < 2)
+        return false;
+    char *key_end = p;
+
+    p = skip_blank(p);
+    if (*p != '=')
+        return false;
+    p = skip_blank(p + 1);
+
+    /* Drop the trailing white space */
+    char *value_end = end;
+    while (value_end > p && isblank(value_end[-1]))
+        --value_end;
+
+    *key_end = '\0';
+    *value_end = '\0';
+    *name = key;
+    *value = p;
+    return true;
+}
+
+/* Loads the file without augeas.
+ *
+ * Returns 1 if the file was loaded and 0 if it does not exist. Returns -1
+ * if the file must be loaded by augeas: it can't be read, does not match
+ * the Libreport lens or contains an option more times (augeas reports such
+ * options with an index, e.g. 'Option[2]').
+ */
+static int load_conf_file_natively(const char *real_path, map_string_t *settings, bool skipKeysWithoutValue)
+{
+    size_t size = INT_MAX - 4095; /* the default limit of xmalloc_read() */
+    char *data = xmalloc_open_read_close(real_path, &size);
+    if (data == NULL)
+    {
+        if (errno != ENOENT)
+            return -1;
+
+        /* The same as internal_aug_get_all_option_names() with GAON_FAIL_ON_NOENT */
+        if (g_verbose > 1)
+            perror_msg("Cannot read conf file '%s'", real_path);
+        return 0;
+    }
+
+    int retval = -1;
+    map_string_t *options = new_map_string();
+
+    /* augeas can't parse files with NUL bytes */
+    if (strlen(data) != size)
         goto finalize;
 
+    for (char *line = data; *line != '\0'; )
+    {
+        char *end = strchr(line, '\n');
+        /* Every line of the lens ends with '\n' */
+        if (end == NULL)
+            goto finalize;
+
+        char *name;
+        char *value;
+        if (!parse_conf_line(line, end, &name, &value))
+            goto finalize;
+
+        if (name != NULL)
+        {
+            if (get_map_string_item_or_NULL(options, name) != NULL)
+                goto finalize;
+
+            insert_map_string(options, xstrdup(name), xstrdup(value));
+        }
+
+        line = end + 1;
+    }
+
+    if (g_hash_table_size(options) == 0)
+        log_info("Configuration file '%s' contains no option", real_path);
+
+    const char *name;
+    const char *value;
+    map_string_iter_t iter;
+    init_map_string_iter(&iter, options);
+    while (next_map_string_iter(&iter, &name, &value))
+    {
+        log_info("Loaded option '%s' = '%s'", name, value);
+
+        if (!skipKeysWithoutValue || value[0] != '\0')
+            replace_map_string_item(settings, xstrdup(name), xstrdup(value));
+    }
+    retval = 1;
+
+finalize:
+    free_map_string(options);
+    free(data);
+
+    return retval;
+}
+
+/* Reads the options of the file from the loaded augeas tree */
+static bool load_conf_file_aug(augeas *aug, const char *real_path, map_string_t *settings, bool skipKeysWithoutValue)
+{
+    bool retval = false;
     char **matches = NULL;
     int match_num = 0;
     if (!internal_aug_get_all_option_names(aug, real_path, &matches, &match_num, GAON_FAIL_ON_NOENT))
-        goto finalize;
+        return false;
 
     int i = 0;
     for (; i < match_num; ++i)
@@ -311,13 +442,85 @@ cleanup:
         free(matches[i]);
     free(matches);
 
-finalize:
-    if (aug != NULL)
-        aug_close(aug);
+    return retval;
+}
+
+/* Returns false if any error occurs, else returns true.
+ *
+ * The files are parsed natively. The files the native parser does not accept
+ * are loaded by one augeas instance, so the lens is compiled only once and the
+ * errors are reported the same way as before.
+ * $LIBREPORT_DEBUG_AUGEAS_CONF forces augeas for all files.
+ */
+bool load_conf_files(const char *const *paths, map_string_t *const *settings, bool skipKeysWithoutValue)
+{
+    bool retval = true;
+
+    size_t count = 0;
+    while (paths[count] != NULL)
+        ++count;
+
+    const bool native = (getenv("LIBREPORT_DEBUG_AUGEAS_CONF") == NULL);
+
+    char **aug_paths = xmalloc(count * sizeof(aug_paths[0]));
+    map_string_t **aug_settings = xmalloc(count * sizeof(aug_settings[0]));
+    size_t aug_count = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        char real_path[PATH_MAX + 1];
+        if (!canonicalize_path(paths[i], real_path))
+        {
+            VERB3 perror_msg("Cannot get real path for '%s'", paths[i]);
+            retval = false;
+            continue;
+        }
+
+        if (native)
+        {
+            const int r = load_conf_file_natively(real_path, settings[i], skipKeysWithoutValue);
+            if (r == 0)
+                retval = false;
+            if (r >= 0)
+                continue;
+
+            log_debug("Falling back to augeas for '%s'", real_path);
+        }
+
+        aug_paths[aug_count] = xstrdup(real_path);
+        aug_settings[aug_count] = settings[i];
+        ++aug_count;
+    }
+
+    if (aug_count > 0)
+    {
+        augeas *aug = NULL;
+        if (internal_aug_init_files(&aug, (const char *const *)aug_paths, aug_count))
+        {
+            for (size_t i = 0; i < aug_count; ++i)
+                retval = load_conf_file_aug(aug, aug_paths[i], aug_settings[i], skipKeysWithoutValue) && retval;
+        }
+        else
+            retval = false;
+
+        if (aug != NULL)
+            aug_close(aug);
+    }
+
+    for (size_t i = 0; i < aug_count; ++i)
+        free(aug_paths[i]);
+    free(aug_paths);
+    free(aug_settings);
 
     return retval;
 }
 
+bool load_conf_file(const char *path, map_string_t *settings, bool skipKeysWithoutValue)
+{
+    const char *const paths[] = { path, NULL };
+    return load_conf_files(paths, &settings, skipKeysWithoutValue);
+}
+
 const char *get_user_conf_base_dir(void)
 {
     static char *base_dir = NULL;
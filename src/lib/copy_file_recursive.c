@@ -28,7 +28,10 @@ int copy_file_recursive(const char *source, const char *dest)
 	int retval = 0;
 	int dest_exists = 0;
 
-	if (strcmp(source, ".lock") == 0)
+	/* Lock files of a dump directory: .lock and .rlock.PID.N */
+	const char *base_name = strrchr(source, '/');
+	base_name = base_name ? base_name + 1 : source;
+	if (strcmp(base_name, ".lock") == 0 || prefixcmp(base_name, ".rlock.") == 0)
 		goto skip;
 
 	if (stat(source, &source_stat) < 0) {
@@ -21,14 +21,188 @@
  * Utility routines.
  *
  */
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h> /* FICLONE */
 #include "internal_libreport.h"
 
 #define CONFIG_FEATURE_COPYBUF_KB 4
 
+/* The largest number of Bytes we ask the kernel to copy at once.
+ * copy_file_range(), sendfile() and splice() never transfer more than
+ * 2GiB - 4KiB in one call anyway. */
+#define KERNEL_COPY_CHUNK (1 << 30)
+
 static const char msg_write_error[] = "write error";
 static const char msg_read_error[] = "read error";
+static const char msg_copy_error[] = "copy error";
 
-static off_t full_fd_action(int src_fd, int dst_fd, off_t size, int flags)
+enum {
+	KERNEL_COPY_ERROR = -1,
+	/* Nothing or only a part of data was copied, continue in user space */
+	KERNEL_COPY_FALLBACK = 0,
+	/* EOF or the requested size was reached */
+	KERNEL_COPY_DONE = 1,
+};
+
+enum {
+	KERNEL_COPY_FILE_RANGE,
+	KERNEL_COPY_SENDFILE,
+	KERNEL_COPY_SPLICE,
+	KERNEL_COPY_METHOD_COUNT,
+};
+
+/* The errors the kernel reports for file descriptors a particular copy
+ * method cannot handle (different file systems, O_APPEND, special files,
+ * old kernels). The data can still be copied by other means. */
+static bool is_kernel_copy_unsupported(int err)
+{
+	return err == ENOSYS || err == EINVAL || err == EXDEV || err == EBADF
+	    || err == EOPNOTSUPP || err == ENOTTY || err == ETXTBSY;
+}
+
+static bool is_kernel_copy_applicable(int method, const struct stat *src_st, const struct stat *dst_st)
+{
+	switch (method) {
+	case KERNEL_COPY_FILE_RANGE:
+		return S_ISREG(src_st->st_mode) && S_ISREG(dst_st->st_mode);
+	case KERNEL_COPY_SENDFILE:
+		/* The source must support mmap-like operations */
+		return S_ISREG(src_st->st_mode);
+	case KERNEL_COPY_SPLICE:
+		return S_ISFIFO(src_st->st_mode) || S_ISFIFO(dst_st->st_mode);
+	}
+	return false;
+}
+
+static ssize_t kernel_copy_chunk(int method, int src_fd, int dst_fd, size_t chunk)
+{
+	switch (method) {
+	case KERNEL_COPY_FILE_RANGE:
+#if HAVE_COPY_FILE_RANGE
+		return copy_file_range(src_fd, NULL, dst_fd, NULL, chunk, 0);
+#else
+		errno = ENOSYS;
+		return -1;
+#endif
+	case KERNEL_COPY_SENDFILE:
+		return sendfile(dst_fd, src_fd, NULL, chunk);
+	case KERNEL_COPY_SPLICE:
+		return splice(src_fd, NULL, dst_fd, NULL, chunk, SPLICE_F_MOVE);
+	}
+	errno = ENOSYS;
+	return -1;
+}
+
+/* Makes the destination share the data extents with the source (btrfs, XFS
+ * and other CoW file systems). Possible only if both are regular files, we
+ * are at the beginning of both and the destination is empty.
+ *
+ * Returns 1 if the file was cloned, 0 if cloning is not possible and -1 on
+ * errors.
+ */
+static int clone_file(int src_fd, int dst_fd, off_t size,
+		const struct stat *src_st, const struct stat *dst_st, off_t *copied)
+{
+#ifdef FICLONE
+	if (!S_ISREG(src_st->st_mode) || !S_ISREG(dst_st->st_mode) || dst_st->st_size != 0)
+		return 0;
+
+	/* Clones whole files only, a copy cannot be limited to size Bytes */
+	if (size && src_st->st_size > size)
+		return 0;
+
+	if (lseek(src_fd, 0, SEEK_CUR) != 0 || lseek(dst_fd, 0, SEEK_CUR) != 0)
+		return 0;
+
+	if (ioctl(dst_fd, FICLONE, src_fd) != 0)
+		return 0;
+
+	/* FICLONE does not move file offsets */
+	if (lseek(src_fd, src_st->st_size, SEEK_SET) < 0
+	 || lseek(dst_fd, src_st->st_size, SEEK_SET) < 0
+	) {
+		perror_msg("%s", msg_copy_error);
+		return -1;
+	}
+
+	*copied = src_st->st_size;
+	return 1;
+#else
+	return 0;
+#endif
+}
+
+/* Copies up to size Bytes (until EOF if size is 0) from src_fd to dst_fd
+ * without passing the data through user space. Tries to reflink the file
+ * first, then uses copy_file_range(), sendfile() or splice(), depending on
+ * what the file descriptors are.
+ *
+ * Uses and moves the current file offsets, so the copy can be finished in
+ * user space if the kernel cannot copy (all) the data. The number of copied
+ * Bytes is stored in copied.
+ */
+static int kernel_copy(int src_fd, int dst_fd, off_t size, off_t *copied)
+{
+	*copied = 0;
+
+	struct stat src_st, dst_st;
+	if (fstat(src_fd, &src_st) != 0 || fstat(dst_fd, &dst_st) != 0)
+		return KERNEL_COPY_FALLBACK;
+
+	/* Pseudo-files (e.g. in /proc) pretend to be empty and the kernel
+	 * copies nothing from them, only read() can get their contents. */
+	if (S_ISREG(src_st.st_mode) && src_st.st_size == 0)
+		return KERNEL_COPY_FALLBACK;
+
+	if (clone_file(src_fd, dst_fd, size, &src_st, &dst_st, copied) < 0)
+		return KERNEL_COPY_ERROR;
+
+	/* Continue even after a successful clone, the file might have grown */
+	for (int method = 0; method < KERNEL_COPY_METHOD_COUNT; ++method) {
+		if (!is_kernel_copy_applicable(method, &src_st, &dst_st))
+			continue;
+
+		off_t method_copied = 0;
+		while (1) {
+			if (size && *copied >= size)
+				return KERNEL_COPY_DONE;
+
+			size_t chunk = KERNEL_COPY_CHUNK;
+			if (size && size - *copied < (off_t)chunk)
+				chunk = size - *copied;
+
+			ssize_t r = kernel_copy_chunk(method, src_fd, dst_fd, chunk);
+			if (r > 0) {
+				*copied += r;
+				method_copied += r;
+				continue;
+			}
+			if (r == 0) {
+				/* Don't trust EOF reported before anything was
+				 * copied, let read() confirm it. */
+				if (method_copied == 0)
+					return KERNEL_COPY_FALLBACK;
+				return KERNEL_COPY_DONE;
+			}
+			if (errno == EINTR)
+				continue;
+			/* Non-blocking descriptors, read() knows what to do */
+			if (errno == EAGAIN)
+				return KERNEL_COPY_FALLBACK;
+			if (!is_kernel_copy_unsupported(errno)) {
+				perror_msg("%s", msg_copy_error);
+				return KERNEL_COPY_ERROR;
+			}
+			/* Try the next method, the offsets are consistent */
+			break;
+		}
+	}
+
+	return KERNEL_COPY_FALLBACK;
+}
+
+static off_t buffered_fd_action(int src_fd, int dst_fd, off_t size, int flags)
 {
 	int status = -1;
 	off_t total = 0;
@@ -128,6 +302,133 @@ static off_t full_fd_action(int src_fd, int dst_fd, off_t size, int flags)
 	return status ? -1 : total;
 }
 
+/* Copies only the data extents of a sparse regular file and leaves holes in
+ * the destination where the source has them. The extents are found with
+ * lseek(SEEK_DATA/SEEK_HOLE) and copied in user space, where blocks of zeros
+ * are still turned into holes.
+ *
+ * Stops at the source size seen at the beginning, the caller finishes the
+ * copy in user space (i.e. confirms EOF or copies data appended meanwhile).
+ * Returns KERNEL_COPY_FALLBACK without touching anything if the file
+ * descriptors are not regular files or the file system cannot find holes.
+ */
+static int sparse_copy(int src_fd, int dst_fd, off_t size, off_t *copied)
+{
+	*copied = 0;
+
+	struct stat src_st, dst_st;
+	if (fstat(src_fd, &src_st) != 0 || fstat(dst_fd, &dst_st) != 0)
+		return KERNEL_COPY_FALLBACK;
+
+	if (!S_ISREG(src_st.st_mode) || !S_ISREG(dst_st.st_mode))
+		return KERNEL_COPY_FALLBACK;
+
+	const off_t src_start = lseek(src_fd, 0, SEEK_CUR);
+	const off_t dst_start = lseek(dst_fd, 0, SEEK_CUR);
+	if (src_start < 0 || dst_start < 0 || src_start >= src_st.st_size)
+		return KERNEL_COPY_FALLBACK;
+
+	off_t src_end = src_st.st_size;
+	if (size && src_end - src_start > size)
+		src_end = src_start + size;
+
+	off_t data = lseek(src_fd, src_start, SEEK_DATA);
+	if (data < 0 && errno != ENXIO)
+		/* EINVAL: the file system does not know SEEK_DATA */
+		return KERNEL_COPY_FALLBACK;
+
+	/* ENXIO: there is no data after the offset */
+	while (data >= 0 && data < src_end) {
+		off_t hole = lseek(src_fd, data, SEEK_HOLE);
+		if (hole < 0) {
+			perror_msg("%s", msg_read_error);
+			return KERNEL_COPY_ERROR;
+		}
+		if (hole > src_end)
+			hole = src_end;
+
+		if (lseek(src_fd, data, SEEK_SET) < 0) {
+			perror_msg("%s", msg_read_error);
+			return KERNEL_COPY_ERROR;
+		}
+		if (lseek(dst_fd, dst_start + (data - src_start), SEEK_SET) < 0) {
+			perror_msg("%s", msg_write_error);
+			return KERNEL_COPY_ERROR;
+		}
+
+		/* Blocks of zeros inside of the extent become holes too */
+		if (buffered_fd_action(src_fd, dst_fd, hole - data, COPYFD_SPARSE) < 0)
+			return KERNEL_COPY_ERROR;
+
+		data = lseek(src_fd, hole, SEEK_DATA);
+		if (data < 0 && errno != ENXIO) {
+			perror_msg("%s", msg_read_error);
+			return KERNEL_COPY_ERROR;
+		}
+	}
+
+	/* The copied range may end with a hole */
+	const off_t dst_end = dst_start + (src_end - src_start);
+	if (fstat(dst_fd, &dst_st) != 0
+	 || (dst_st.st_size < dst_end && ftruncate(dst_fd, dst_end) != 0)
+	) {
+		perror_msg("%s", msg_write_error);
+		return KERNEL_COPY_ERROR;
+	}
+
+	if (lseek(src_fd, src_end, SEEK_SET) < 0 || lseek(dst_fd, dst_end, SEEK_SET) < 0) {
+		perror_msg("%s", msg_copy_error);
+		return KERNEL_COPY_ERROR;
+	}
+
+	*copied = src_end - src_start;
+	return (size && *copied >= size) ? KERNEL_COPY_DONE : KERNEL_COPY_FALLBACK;
+}
+
+/* Copies the data in kernel if possible and in user space otherwise.
+ *
+ * Returns the number of read Bytes, which is greater than size if the source
+ * contains more than size Bytes (only size Bytes are written).
+ *
+ * COPYFD_SPARSE needs to see the data to find blocks of zeros, hence sparse
+ * copies are done in user space. Holes of regular files are skipped without
+ * reading them.
+ */
+static off_t full_fd_action(int src_fd, int dst_fd, off_t size, int flags)
+{
+	off_t copied = 0;
+
+	if (src_fd >= 0 && dst_fd >= 0) {
+		const int r = (flags & COPYFD_SPARSE)
+				? sparse_copy(src_fd, dst_fd, size, &copied)
+				: kernel_copy(src_fd, dst_fd, size, &copied);
+		switch (r) {
+		case KERNEL_COPY_ERROR:
+			return -1;
+		case KERNEL_COPY_DONE:
+			if (size && copied >= size) {
+				/* Let the callers detect overflows the same
+				 * way full_fd_action() always did */
+				char buffer[CONFIG_FEATURE_COPYBUF_KB * 1024];
+				ssize_t rd = safe_read(src_fd, buffer, sizeof(buffer));
+				if (rd < 0) {
+					perror_msg("%s", msg_read_error);
+					return -1;
+				}
+				copied += rd;
+			}
+			return copied;
+		case KERNEL_COPY_FALLBACK:
+			if (size)
+				size -= copied;
+			break;
+		}
+	}
+
+	off_t r = buffered_fd_action(src_fd, dst_fd, size, flags);
+	return r < 0 ? r : copied + r;
+}
+
 off_t copyfd_ext_at(int src, int dir_fd, const char *name, int mode, uid_t uid, gid_t gid, int open_flags, int copy_flags, off_t size)
 {
     int dst = openat(dir_fd, name, open_flags, mode);
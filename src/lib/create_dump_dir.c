@@ -166,6 +166,9 @@ int save_problem_data_in_dump_dir(struct dump_dir *dd, problem_data_t *problem_d
     g_hash_table_iter_init(&iter, problem_data);
     while (g_hash_table_iter_next(&iter, (void**)&name, (void**)&value))
     {
+        if (problem_item_load(value) != 0)
+            continue;
+
         if (!str_is_correct_filename(name))
         {
             error_msg("Problem data field name contains disallowed chars: '%s'", name);
@@ -233,6 +233,114 @@ static size_t fread_with_reporting(void *ptr, size_t size, size_t nmemb, void *u
     return fread(ptr, size, nmemb, fp);
 }
 
+/* Upload data produced on the fly
+ *
+ * The producer writes to the write end of a pipe from a separate thread while
+ * curl reads from the read end. The pipe is the only buffer between the two,
+ * so the memory used does not depend on the size of the uploaded data.
+ */
+#define UPLOAD_STREAM_BUFFER_SIZE (1024 * 1024)
+
+struct upload_stream
+{
+    upload_stream_producer_t producer;
+    void *args;
+    int rfd;
+    int wfd;
+    int result;
+    off_t transferred;
+    GThread *thread;
+};
+
+static gpointer upload_stream_thread(gpointer user_data)
+{
+    struct upload_stream *stream = (struct upload_stream *)user_data;
+
+    const int r = stream->producer(stream->wfd, stream->args);
+    g_atomic_int_set(&stream->result, r);
+
+    /* Must be done after the result is set. Reader sees EOF only then. */
+    close(stream->wfd);
+    stream->wfd = -1;
+
+    return NULL;
+}
+
+static int upload_stream_start(struct upload_stream *stream)
+{
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) != 0)
+    {
+        perror_msg("pipe");
+        return -1;
+    }
+
+    /* Bound the in-flight data by the capacity of the pipe */
+    if (fcntl(pipefd[1], F_SETPIPE_SZ, UPLOAD_STREAM_BUFFER_SIZE) < 0)
+        log_debug("Can't resize upload pipe: %s", strerror(errno));
+
+    stream->rfd = pipefd[0];
+    stream->wfd = pipefd[1];
+    stream->result = 0;
+    stream->transferred = 0;
+    stream->thread = g_thread_new("upload-producer", upload_stream_thread, stream);
+
+    return 0;
+}
+
+/* Returns the result of the producer */
+static int upload_stream_finish(struct upload_stream *stream)
+{
+    /* Unblocks the producer if curl gave up before reaching EOF */
+    close(stream->rfd);
+    stream->rfd = -1;
+
+    g_thread_join(stream->thread);
+    stream->thread = NULL;
+
+    return stream->result;
+}
+
+/* "read local data from a stream" callback */
+static size_t read_stream_with_reporting(void *ptr, size_t size, size_t nmemb, void *userdata)
+{
+    static time_t last_t; // hack
+    static time_t report_interval;
+
+    struct upload_stream *stream = (struct upload_stream *)userdata;
+
+    time_t t = time(NULL);
+
+    if (stream->transferred == 0) /* first call */
+    {
+        last_t = t;
+        report_interval = 15;
+    }
+
+    /* Same schedule as fread_with_reporting(), but the total is unknown */
+    if ((t - last_t) >= report_interval)
+    {
+        last_t = t;
+        report_interval *= 2;
+        log_warning(_("Uploaded: %llu kbytes"),
+                (unsigned long long)stream->transferred / 1024);
+    }
+
+    const ssize_t r = safe_read(stream->rfd, ptr, size * nmemb);
+    if (r < 0)
+    {
+        perror_msg("Can't read upload data");
+        return CURL_READFUNC_ABORT;
+    }
+
+    /* Do not let a truncated stream look like a complete upload */
+    if (r == 0 && g_atomic_int_get(&stream->result) != 0)
+        return CURL_READFUNC_ABORT;
+
+    stream->transferred += r;
+    return r;
+}
+
 static int curl_debug(CURL *handle, curl_infotype it, char *buf, size_t bufsize, void *unused)
 {
     if (logmode == 0)
@@ -294,13 +402,14 @@ static int curl_debug(CURL *handle, curl_infotype it, char *buf, size_t bufsize,
     return 0;
 }
 
-int
-post(post_state_t *state,
+static int
+post_ext(post_state_t *state,
                 const char *url,
                 const char *content_type,
                 const char **additional_headers,
                 const char *data,
-                off_t data_size)
+                off_t data_size,
+                struct upload_stream *stream)
 {
     INITIALIZE_LIBREPORT();
 
@@ -373,7 +482,14 @@ post(post_state_t *state,
     struct curl_slist *httpheader_list = NULL;
 
     // Supply data...
-    if (data_size == POST_DATA_FROMFILE
+    if (stream)
+    {
+        // ...from a stream of unknown size (only with POST_DATA_FROMFILE_PUT)
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READDATA, stream);
+        xcurl_easy_setopt_ptr(handle, CURLOPT_READFUNCTION, (const void*)read_stream_with_reporting);
+        xcurl_easy_setopt_long(handle, CURLOPT_UPLOAD, 1);
+    }
+    else if (data_size == POST_DATA_FROMFILE
      || data_size == POST_DATA_FROMFILE_PUT
     ) {
         // ...from a file
@@ -590,6 +706,17 @@ post(post_state_t *state,
     return response_code;
 }
 
+int
+post(post_state_t *state,
+                const char *url,
+                const char *content_type,
+                const char **additional_headers,
+                const char *data,
+                off_t data_size)
+{
+    return post_ext(state, url, content_type, additional_headers, data, data_size, /*stream*/NULL);
+}
+
 /* Unlike post_file(),
  * this function will use PUT, not POST if url is "http(s)://..."
  */
@@ -602,7 +729,8 @@ char *upload_file(const char *url, const char *filename)
     return retval;
 }
 
-char *upload_file_ext(post_state_t *state, const char *url, const char *filename, int flags)
+static char *upload_ext(post_state_t *state, const char *url, const char *filename,
+        struct upload_stream *stream, int flags)
 {
     /* we don't want to print the whole url as it may contain password
      * rhbz#856960
@@ -655,6 +783,14 @@ char *upload_file_ext(post_state_t *state, const char *url, const char *filename
      */
     int stdin_bck = dup(0);
 
+    /* The producer writes to a pipe whose reader, curl, can give up early.
+     * Ignore SIGPIPE here, before any producer thread is started, as the
+     * disposition is shared by all threads.
+     */
+    sighandler_t old_sigpipe_handler = SIG_DFL;
+    if (stream)
+        old_sigpipe_handler = signal(SIGPIPE, SIG_IGN);
+
     /*
      * Well, goto seems to be the most elegant syntax form here :(
      * This label is used to re-try the upload with an updated credentials.
@@ -664,17 +800,37 @@ char *upload_file_ext(post_state_t *state, const char *url, const char *filename
     /* Do not include the path part of the URL as it can contain sensitive data
      * in case of typos */
     log_warning(_("Sending %s to %s//%s"), filename, scheme, hostname);
-    post(state,
+
+    /* A stream cannot be rewound, the producer has to start over */
+    if (stream && upload_stream_start(stream) != 0)
+    {
+        free(whole_url);
+        whole_url = NULL;
+        goto restore;
+    }
+
+    post_ext(state,
                 whole_url,
                 /*content_type:*/ "application/octet-stream",
                 /*additional_headers:*/ NULL,
                 /*data:*/ filename,
-                POST_DATA_FROMFILE_PUT
+                POST_DATA_FROMFILE_PUT,
+                stream
     );
 
     dup2(stdin_bck, 0);
 
     int error = (state->curl_result != 0);
+
+    /* When curl fails early, the producer gets EPIPE because the pipe is
+     * closed. Its result matters only if curl believes the upload succeeded.
+     */
+    if (stream && upload_stream_finish(stream) != 0 && !error)
+    {
+        error_msg("Failed to produce the uploaded data");
+        error = 1;
+    }
+
     if (error)
     {
         if (state->curl_error_msg)
@@ -719,6 +875,9 @@ char *upload_file_ext(post_state_t *state, const char *url, const char *filename
         log_warning(_("Successfully created %s"), whole_url);
     }
 
+restore:
+    if (stream)
+        signal(SIGPIPE, old_sigpipe_handler);
     close(stdin_bck);
 
 finito:
@@ -733,3 +892,21 @@ finito:
 
     return whole_url;
 }
+
+char *upload_file_ext(post_state_t *state, const char *url, const char *filename, int flags)
+{
+    return upload_ext(state, url, filename, /*stream*/NULL, flags);
+}
+
+char *upload_stream_ext(post_state_t *state, const char *url, const char *filename,
+        upload_stream_producer_t producer, void *args, int flags)
+{
+    struct upload_stream stream = {
+        .producer = producer,
+        .args = args,
+        .rfd = -1,
+        .wfd = -1,
+    };
+
+    return upload_ext(state, url, filename, &stream, flags);
+}
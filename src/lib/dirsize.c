@@ -61,7 +61,7 @@ static bool this_is_a_dd(const char *dirname)
     logmode = 0;
 
     struct dump_dir *dd = dd_opendir(dirname,
-                /*flags:*/ DD_OPEN_READONLY | DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES
+                /*flags:*/ DD_OPEN_SHARED | DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES
     );
     dd_close(dd);
 
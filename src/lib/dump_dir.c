@@ -17,7 +17,11 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 #include <sys/utsname.h>
+#include <sys/inotify.h>
 #include <libtar.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "internal_libreport.h"
 
 // Locking logic:
@@ -53,6 +57,29 @@
 // correctly. For example, dd_create should retry locking
 // its newly-created directory much faster than dd_opendir
 // tries to lock the directory it tries to open.
+//
+// Waiting for other process to unlock the directory does not need to
+// sleep for the whole timeout. The waiters watch the directory via inotify
+// and wake up as soon as .lock is removed. The timeouts are still used as
+// an upper bound, because the lock holder may die without removing .lock
+// (we detect that only by checking its pid) and because inotify may not be
+// available (exhausted limits, some network file systems), in which case we
+// fall back to plain sleeping.
+//
+// Readers (dd_opendir with DD_OPEN_SHARED) do not take .lock. Each reader
+// creates its own symlink named .rlock.PID.N pointing to "PID:STARTTIME",
+// where STARTTIME comes from /proc/PID/stat, so that a lock left behind by
+// a crashed reader is not mistaken for a live process which got the
+// recycled PID. Then the reader checks that .lock does not
+// exist (or is stale or ours). If .lock is held by other process, the reader
+// removes its symlink and waits. Writers create .lock as before and then wait
+// until all .rlock.* symlinks of live processes disappear. Because both sides
+// first announce themselves and only then look for the other side, at least
+// one of them always notices the other. New readers back off while .lock
+// exists, hence writers cannot be starved.
+//
+// Processes using older libreport lock readers out by .lock as they always
+// did, but they do not know about .rlock.* and do not wait for readers.
 
 
 // How long to sleep between "symlink fails with EEXIST,
@@ -78,6 +105,9 @@
 #define NO_TIME_FILE_USLEEP            (50*1000)
 #define NO_TIME_FILE_COUNT                   10
 
+// Prefix of symlinks created by readers holding a shared lock
+#define READER_LOCK_PREFIX             ".rlock."
+
 // How long to sleep after we unlocked an empty dir, but then rmdir failed
 // (some idiot jumped the gun and locked the dir we are deleting);
 // and after how many tries to give up:
@@ -90,6 +120,9 @@
 // does not exist (backward compatibility).
 #define META_DATA_DIR_NAME             ".libreport"
 #define META_DATA_FILE_OWNER           "owner"
+// An index of dump directory items, see dd_index_load()
+#define META_DATA_FILE_INDEX           "index"
+#define DD_INDEX_HEADER                "libreport-dd-index 2"
 
 enum {
     /* Try to create meta-data dir if it does not exist */
@@ -116,6 +149,7 @@ static void copy_file_from_chroot(struct dump_dir* dd, const char *name,
         const char *chroot_dir, const char *file_path);
 static bool save_binary_file_at(int dir_fd, const char *name, const char* data,
         unsigned size, uid_t uid, gid_t gid, mode_t mode);
+static int fdreopen(int dir_fd, DIR **d);
 
 static bool isdigit_str(const char *str)
 {
@@ -419,9 +453,205 @@ static const char *dd_check(struct dump_dir *dd)
     return NULL;
 }
 
+/* Returns true if .lock exists. */
+static bool dd_has_writer(struct dump_dir *dd)
+{
+    struct stat lock_sb;
+    return fstatat(dd->dd_fd, ".lock", &lock_sb, AT_SYMLINK_NOFOLLOW) == 0
+        || errno != ENOENT;
+}
+
+/* Returns the start time of the process in clock ticks after boot (the 22nd
+ * field of /proc/PID/stat), 0 if the process does not exist.
+ */
+static unsigned long long get_process_start_time(unsigned long pid)
+{
+    char stat_name[sizeof("/proc//stat") + sizeof(long)*3];
+    snprintf(stat_name, sizeof(stat_name), "/proc/%lu/stat", pid);
+
+    char buf[1024];
+    const int fd = open(stat_name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return 0;
+    const ssize_t r = full_read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (r <= 0)
+        return 0;
+    buf[r] = '\0';
+
+    /* The command name can contain spaces and parentheses */
+    const char *fields = strrchr(buf, ')');
+    unsigned long long start_time;
+    if (!fields || sscanf(fields + 1,
+                " %*c %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %*s %llu",
+                &start_time) != 1)
+        return 0;
+
+    return start_time;
+}
+
+/* Returns true if the process which created the reader lock is alive */
+static bool dd_reader_is_alive(struct dump_dir *dd, const char *rlock_name, unsigned long pid)
+{
+    char target[sizeof(long)*3 + sizeof(long long)*3 + 2];
+    const ssize_t r = readlinkat(dd->dd_fd, rlock_name, target, sizeof(target) - 1);
+    if (r < 0)
+        return false;
+    target[r] = '\0';
+
+    char pid_str[sizeof("/proc/") + sizeof(long)*3];
+    snprintf(pid_str, sizeof(pid_str), "/proc/%lu", pid);
+    if (access(pid_str, F_OK) != 0)
+        return false;
+
+    /* Locks created by older libreport contain only the PID and the start
+     * time is unknown if /proc/PID/stat can't be read */
+    const char *colon = strchr(target, ':');
+    const unsigned long long lock_start_time = colon ? strtoull(colon + 1, NULL, 10) : 0;
+    const unsigned long long start_time = get_process_start_time(pid);
+    if (lock_start_time == 0 || start_time == 0)
+        return true;
+
+    return lock_start_time == start_time;
+}
+
+/* Returns true if a process other than the current one holds a shared lock of
+ * the dump directory. Removes reader lock files of dead processes.
+ */
+static bool dd_has_readers(struct dump_dir *dd)
+{
+    DIR *d;
+    if (fdreopen(dd->dd_fd, &d) < 0)
+        return false;
+
+    const unsigned long self = (unsigned long)getpid();
+    bool readers = false;
+    struct dirent *dent;
+    while (!readers && (dent = readdir(d)) != NULL)
+    {
+        if (prefixcmp(dent->d_name, READER_LOCK_PREFIX) != 0)
+            continue;
+
+        unsigned long pid;
+        if (sscanf(dent->d_name + strlen(READER_LOCK_PREFIX), "%lu.", &pid) != 1)
+            continue;
+
+        if (pid == self)
+            continue;
+
+        if (dd_reader_is_alive(dd, dent->d_name, pid))
+        {
+            log_info("Lock file '%s' is locked by reader %lu", dd->dd_dirname, pid);
+            readers = true;
+            continue;
+        }
+
+        log_warning("Reader lock '%s' was created by process %lu, but it crashed?", dent->d_name, pid);
+        /* The file may be deleted by now by other process. Ignore ENOENT */
+        if (unlinkat(dd->dd_fd, dent->d_name, /*only files*/0) != 0 && errno != ENOENT)
+            perror_msg("Can't remove stale lock file '%s'", dent->d_name);
+    }
+    closedir(d);
+
+    return readers;
+}
+
+/* Sleeps until a lock file whose name begins with lock_prefix is removed from
+ * the dump directory or until timeout_usec elapses.
+ *
+ * The function is_locked is called once the directory is being watched to
+ * find out whether the lock was not released in the meantime.
+ *
+ * Returns early also if the directory itself is removed or moved away.
+ * Spurious wake ups are fine, the caller always re-tries to lock.
+ */
+static void dd_wait_for_unlock(struct dump_dir *dd, const char *lock_prefix,
+        bool (*is_locked)(struct dump_dir *), unsigned timeout_usec)
+{
+    int ifd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (ifd < 0)
+    {
+        log_debug("inotify_init1: %s, falling back to sleep", strerror(errno));
+        usleep(timeout_usec);
+        return;
+    }
+
+    char dir_path[sizeof("/proc/self/fd/") + sizeof(int)*3];
+    snprintf(dir_path, sizeof(dir_path), "/proc/self/fd/%d", dd->dd_fd);
+
+    if (inotify_add_watch(ifd, dir_path,
+                IN_DELETE | IN_MOVED_FROM | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR) < 0)
+    {
+        log_debug("inotify_add_watch('%s'): %s, falling back to sleep", dd->dd_dirname, strerror(errno));
+        close(ifd);
+        usleep(timeout_usec);
+        return;
+    }
+
+    /* The lock could have been released between our failed attempt to lock
+     * the directory and adding the watch. Events from now on are not lost.
+     */
+    if (!is_locked(dd))
+        goto finito;
+
+    struct timespec now, deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_usec / 1000000;
+    deadline.tv_nsec += (timeout_usec % 1000000) * 1000;
+    if (deadline.tv_nsec >= 1000000000)
+    {
+        deadline.tv_sec += 1;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    /* Large enough for several events with lock file names */
+    char events[16 * (sizeof(struct inotify_event) + NAME_MAX + 1)]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    while (1)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long remaining_ms = (deadline.tv_sec - now.tv_sec) * 1000LL
+                               + (deadline.tv_nsec - now.tv_nsec) / 1000000;
+        if (remaining_ms <= 0)
+            break;
+
+        struct pollfd pfd = { .fd = ifd, .events = POLLIN };
+        int r = poll(&pfd, 1, (int)remaining_ms);
+        if (r < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break; /* timeout or error; the caller re-tries anyway */
+
+        ssize_t len = read(ifd, events, sizeof(events));
+        if (len < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            break;
+        }
+
+        for (char *p = events; p < events + len; )
+        {
+            const struct inotify_event *ev = (const struct inotify_event *)p;
+
+            if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED | IN_Q_OVERFLOW))
+                goto finito;
+
+            if (ev->len != 0 && prefixcmp(ev->name, lock_prefix) == 0)
+                goto finito;
+
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+
+finito:
+    close(ifd);
+}
+
 static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
 {
-    if (dd->locked)
+    if (dd->locked || dd->dd_rlock_name)
         error_msg_and_die("Locking bug on '%s'", dd->dd_dirname);
 
     char pid_buf[sizeof(long)*3 + 2];
@@ -443,7 +673,7 @@ static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
             return -1;
         }
         /* Other process has the lock, wait for it to go away */
-        usleep(sleep_usec);
+        dd_wait_for_unlock(dd, ".lock", dd_has_writer, sleep_usec);
     }
 
     /* Reset errno to 0 only if errno is EALREADY (used by
@@ -452,6 +682,22 @@ static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
     if (!(dd->owns_lock = (errno != EALREADY)))
         errno = 0;
 
+    /* New readers cannot come in now, wait for the current ones to finish.
+     * If we do not own the lock, the owner has already waited.
+     */
+    while (dd->owns_lock && dd_has_readers(dd))
+    {
+        if (flags & DD_DONT_WAIT_FOR_LOCK)
+        {
+            xunlinkat(dd->dd_fd, ".lock", /*only files*/0);
+            dd->owns_lock = 0;
+            errno = EAGAIN;
+            return -1;
+        }
+        dd_wait_for_unlock(dd, READER_LOCK_PREFIX, dd_has_readers, sleep_usec);
+    }
+    errno = 0;
+
     /* Are we called by dd_opendir (as opposed to dd_create)? */
     if (sleep_usec == WAIT_FOR_OTHER_PROCESS_USLEEP) /* yes */
     {
@@ -481,8 +727,148 @@ static int dd_lock(struct dump_dir *dd, unsigned sleep_usec, int flags)
     return 0;
 }
 
+/* Return values:
+ * -1: error (errno is set)
+ *  0: .lock does not exist, is stale or is owned by pid
+ *  1: .lock is held by other process
+ */
+static int dd_check_writer_lock(struct dump_dir *dd, const char *pid)
+{
+    char pid_buf[sizeof(pid_t)*3 + 4];
+    ssize_t r = readlinkat(dd->dd_fd, ".lock", pid_buf, sizeof(pid_buf) - 1);
+    if (r < 0)
+    {
+        if (errno == ENOENT)
+            return 0;
+
+        perror_msg("Can't read lock file '%s/.lock'", dd->dd_dirname);
+        return -1;
+    }
+    pid_buf[r] = '\0';
+
+    if (strcmp(pid_buf, pid) == 0)
+        return 0;
+
+    if (isdigit_str(pid_buf))
+    {
+        char pid_str[sizeof("/proc/") + sizeof(pid_buf)];
+        snprintf(pid_str, sizeof(pid_str), "/proc/%s", pid_buf);
+        if (access(pid_str, F_OK) == 0)
+        {
+            log_info("Lock file '%s/.lock' is locked by process %s", dd->dd_dirname, pid_buf);
+            return 1;
+        }
+        log_warning("Lock file '%s/.lock' was locked by process %s, but it crashed?", dd->dd_dirname, pid_buf);
+    }
+
+    /* Our reader lock already exists, so the writer which might create .lock
+     * after we remove the stale one will wait for us.
+     * The file may be deleted by now by other process. Ignore ENOENT */
+    if (unlinkat(dd->dd_fd, ".lock", /*only files*/0) != 0 && errno != ENOENT)
+    {
+        perror_msg("Can't remove stale lock file '%s/.lock'", dd->dd_dirname);
+        return -1;
+    }
+
+    return 0;
+}
+
+/* Acquires a shared lock. See the locking logic description at the top of
+ * this file.
+ */
+static int dd_lock_shared(struct dump_dir *dd, int flags)
+{
+    if (dd->locked || dd->dd_rlock_name)
+        error_msg_and_die("Locking bug on '%s'", dd->dd_dirname);
+
+    /* Distinguishes several shared locks held by one process */
+    static unsigned reader_lock_seq;
+
+    char pid_buf[sizeof(long)*3 + 2];
+    snprintf(pid_buf, sizeof(pid_buf), "%lu", (long)getpid());
+    char *rlock_name = xasprintf(READER_LOCK_PREFIX"%s.%u", pid_buf, reader_lock_seq++);
+    char *rlock_target = xasprintf("%s:%llu", pid_buf, get_process_start_time(getpid()));
+
+    unsigned count = NO_TIME_FILE_COUNT;
+    while (1)
+    {
+        if (symlinkat(rlock_target, dd->dd_fd, rlock_name) != 0)
+        {
+            if (errno == EEXIST)
+            {
+                /* Left behind by a dead process with the same pid */
+                unlinkat(dd->dd_fd, rlock_name, /*only files*/0);
+                continue;
+            }
+            if (errno != ENOENT && errno != ENOTDIR && errno != EACCES)
+            {
+                perror_msg("Can't create lock file '%s'", rlock_name);
+                errno = 0;
+            }
+            goto fail;
+        }
+
+        int r = dd_check_writer_lock(dd, pid_buf);
+        if (r == 0)
+        {
+            const char *missing_file = dd_check(dd);
+            if (missing_file == NULL)
+                break; /* locked successfully */
+
+            /* See dd_lock() */
+            xunlinkat(dd->dd_fd, rlock_name, /*only files*/0);
+            log_notice("Unlocked '%s' (no or corrupted '%s' file)", dd->dd_dirname, missing_file);
+            if (--count == 0 || flags & DD_DONT_WAIT_FOR_LOCK)
+            {
+                errno = EISDIR; /* "this is an ordinary dir, not dump dir" */
+                goto fail;
+            }
+            usleep(NO_TIME_FILE_USLEEP);
+            continue;
+        }
+
+        /* Writer has the lock or we cannot find it out, let it go */
+        const int err = errno;
+        xunlinkat(dd->dd_fd, rlock_name, /*only files*/0);
+        errno = err;
+
+        if (r < 0)
+            goto fail;
+
+        if (flags & DD_DONT_WAIT_FOR_LOCK)
+        {
+            errno = EAGAIN;
+            goto fail;
+        }
+
+        dd_wait_for_unlock(dd, ".lock", dd_has_writer, WAIT_FOR_OTHER_PROCESS_USLEEP);
+    }
+
+    log_info("Locked '%s/%s'", dd->dd_dirname, rlock_name);
+    dd->dd_rlock_name = rlock_name;
+    free(rlock_target);
+    errno = 0;
+    return 0;
+
+fail:
+    free(rlock_target);
+    free(rlock_name);
+    return -1;
+}
+
 static void dd_unlock(struct dump_dir *dd)
 {
+    if (dd->dd_rlock_name)
+    {
+        if (unlinkat(dd->dd_fd, dd->dd_rlock_name, /*only files*/0) != 0 && errno != ENOENT)
+            perror_msg("Can't remove lock file '%s'", dd->dd_rlock_name);
+
+        log_info("Unlocked '%s/%s'", dd->dd_dirname, dd->dd_rlock_name);
+
+        free(dd->dd_rlock_name);
+        dd->dd_rlock_name = NULL;
+    }
+
     if (dd->locked)
     {
         if (dd->owns_lock)
@@ -711,6 +1097,373 @@ finito:
     return ret;
 }
 
+/* The index of dump directory items.
+ *
+ * The index is a text file in the meta-data directory. The first line is
+ * DD_INDEX_HEADER followed by the size of the item lines at the time the
+ * index was written as a whole. Each of the following lines either describes
+ * one item:
+ *
+ *   <size> <mtime sec>.<mtime nsec> <type> <SHA1 of contents> <name>
+ *
+ * where type is 'T' for items saved as text, 'B' for items saved as binary
+ * data and '-' if the type is not known (the item was copied from a file or
+ * a file descriptor); the hash is '-' if it is not known; or records that the
+ * item was deleted:
+ *
+ *   D <name>
+ *
+ * Item names cannot contain new lines, so the name is simply the rest of the
+ * line. The functions modifying the items append a line and the last line
+ * of an item wins. Once the appended lines outgrow the written ones, the
+ * index is written again sorted by item names with one line per item.
+ *
+ * The index is optional. It is created together with the dump directory or
+ * by dd_rebuild_index() and it is updated by the functions modifying the
+ * items. The functions which cannot track their changes (e.g. dd_open_item()
+ * for writing) remove it. Readers use the index only if it lists the same
+ * items as the directory, which costs a readdir() but no stat() per item, and
+ * fall back to walking the directory otherwise. An outdated index is rebuilt
+ * if the directory is locked. Items rewritten in place by other programs are
+ * not noticed.
+ */
+struct dd_index_item
+{
+    char *name;
+    off_t size;
+    struct timespec mtime;
+    char type;
+    char hash[SHA1_RESULT_LEN*2 + 1];
+};
+
+enum {
+    DD_INDEX_TYPE_UNKNOWN = '-',
+    DD_INDEX_TYPE_TEXT    = 'T',
+    DD_INDEX_TYPE_BINARY  = 'B',
+};
+
+/* The appended lines can always take this many bytes */
+#define DD_INDEX_MIN_APPENDED_SIZE 4096
+
+static void dd_index_item_free(struct dd_index_item *item)
+{
+    if (item == NULL)
+        return;
+
+    free(item->name);
+    free(item);
+}
+
+/* Maps item names to struct dd_index_item, the items own the keys */
+static GHashTable *dd_index_new(void)
+{
+    return g_hash_table_new_full(g_str_hash, g_str_equal,
+                                 NULL, (GDestroyNotify)dd_index_item_free);
+}
+
+static void dd_index_free(GHashTable *index)
+{
+    if (index != NULL)
+        g_hash_table_destroy(index);
+}
+
+static void dd_index_remove(struct dump_dir *dd)
+{
+    const int dd_md_fd = dd_get_meta_data_dir_fd(dd, /*no create*/0);
+    if (dd_md_fd < 0)
+        return;
+
+    if (unlinkat(dd_md_fd, META_DATA_FILE_INDEX, /*only files*/0) != 0 && errno != ENOENT)
+        perror_msg("Can't remove index of '%s'", dd->dd_dirname);
+}
+
+/* Parses the index without checking it against the directory.
+ *
+ * Returns 0 and stores the items in the index parameter on success, -ENOENT
+ * if the dump directory has no index or another negative errno value if the
+ * index cannot be read or is malformed (malformed index is removed).
+ */
+static int dd_index_read(struct dump_dir *dd, GHashTable **index)
+{
+    *index = NULL;
+
+    const int dd_md_fd = dd_get_meta_data_dir_fd(dd, /*no create*/0);
+    if (dd_md_fd < 0)
+        return -ENOENT;
+
+    const int fd = secure_openat_read(dd_md_fd, META_DATA_FILE_INDEX);
+    if (fd < 0)
+        return fd == -ENOENT ? -ENOENT : -EIO;
+
+    char *data = xmalloc_read(fd, NULL);
+    close(fd);
+    if (data == NULL)
+        return -EIO;
+
+    GHashTable *items = dd_index_new();
+    char *line = data;
+    char *eol = strchr(line, '\n');
+    unsigned long written_size;
+    int header_len = 0;
+    if (eol == NULL
+        || sscanf(line, DD_INDEX_HEADER" %lu%n", &written_size, &header_len) != 1
+        || line + header_len != eol)
+        goto malformed;
+
+    for (line = eol + 1; *line != '\0'; line = eol + 1)
+    {
+        eol = strchr(line, '\n');
+        if (eol == NULL)
+            goto malformed;
+        *eol = '\0';
+
+        if (line[0] == 'D' && line[1] == ' ')
+        {
+            if (!dd_validate_element_name(line + 2))
+                goto malformed;
+
+            g_hash_table_remove(items, line + 2);
+            continue;
+        }
+
+        struct dd_index_item *item = xzalloc(sizeof(*item));
+
+        long long size;
+        long long mtime_sec;
+        long mtime_nsec;
+        int name_offset = 0;
+        if (sscanf(line, "%lld %lld.%ld %c %40s%n", &size, &mtime_sec, &mtime_nsec,
+                   &item->type, item->hash, &name_offset) != 5
+            || line[name_offset] != ' '
+            || !dd_validate_element_name(line + name_offset + 1))
+        {
+            dd_index_item_free(item);
+            goto malformed;
+        }
+
+        item->name = xstrdup(line + name_offset + 1);
+        item->size = size;
+        item->mtime.tv_sec = mtime_sec;
+        item->mtime.tv_nsec = mtime_nsec;
+        g_hash_table_replace(items, item->name, item);
+    }
+
+    free(data);
+    *index = items;
+    return 0;
+
+malformed:
+    log_notice("Index of '%s' is malformed", dd->dd_dirname);
+    free(data);
+    dd_index_free(items);
+    if (dd->locked)
+        dd_index_remove(dd);
+    return -EINVAL;
+}
+
+/* Checks that the index lists the items of the directory */
+static bool dd_index_is_current(struct dump_dir *dd, GHashTable *index)
+{
+    const int opendir_fd = dup(dd->dd_fd);
+    if (opendir_fd < 0)
+        return false;
+
+    DIR *dir = fdopendir(opendir_fd);
+    if (dir == NULL)
+    {
+        close(opendir_fd);
+        return false;
+    }
+    rewinddir(dir);
+
+    bool current = true;
+    guint count = 0;
+    struct dirent *dent;
+    while (current && (dent = readdir(dir)) != NULL)
+    {
+        if (!is_regular_file_at(dent, dd->dd_fd))
+            continue;
+
+        current = g_hash_table_contains(index, dent->d_name);
+        ++count;
+    }
+
+    closedir(dir);
+    return current && count == g_hash_table_size(index);
+}
+
+static int dd_index_rebuild(struct dump_dir *dd, GHashTable **index);
+
+/* Reads the index of the dump directory.
+ *
+ * Returns 0 and stores the items in the index parameter on success, -ENOENT
+ * if the dump directory has no index, -ESTALE if the index does not list the
+ * items of the directory and the directory is not locked, or another
+ * negative errno value if the index cannot be read or rebuilt.
+ */
+static int dd_index_load(struct dump_dir *dd, GHashTable **index)
+{
+    int r = dd_index_read(dd, index);
+    if (r != 0 || dd_index_is_current(dd, *index))
+        return r;
+
+    log_notice("Index of '%s' is outdated", dd->dd_dirname);
+    dd_index_free(*index);
+    *index = NULL;
+
+    if (!dd->locked)
+        return -ESTALE;
+
+    return dd_index_rebuild(dd, index);
+}
+
+static gint dd_index_item_cmp(gconstpointer a, gconstpointer b)
+{
+    return strcmp(((const struct dd_index_item *)a)->name,
+                  ((const struct dd_index_item *)b)->name);
+}
+
+static void dd_index_append_item_line(struct strbuf *buf, const struct dd_index_item *item)
+{
+    strbuf_append_strf(buf, "%lld %lld.%09ld %c %s %s\n",
+                       (long long)item->size,
+                       (long long)item->mtime.tv_sec,
+                       (long)item->mtime.tv_nsec,
+                       item->type,
+                       item->hash,
+                       item->name);
+}
+
+/* Writes the whole index sorted by item names */
+static int dd_index_save(struct dump_dir *dd, GHashTable *index)
+{
+    GList *items = g_list_sort(g_hash_table_get_values(index), dd_index_item_cmp);
+
+    struct strbuf *buf = strbuf_new();
+    for (GList *iter = items; iter != NULL; iter = g_list_next(iter))
+        dd_index_append_item_line(buf, iter->data);
+    g_list_free(items);
+
+    char *data = xasprintf(DD_INDEX_HEADER" %u\n%s", buf->len, buf->buf);
+    strbuf_free(buf);
+
+    const int r = dd_meta_data_save_text(dd, META_DATA_FILE_INDEX, data);
+    free(data);
+
+    /* Better no index than an outdated one */
+    if (r < 0)
+        dd_index_remove(dd);
+
+    return r;
+}
+
+/* Appends the line to the index and writes the whole index again once the
+ * appended lines outgrow the written ones.
+ *
+ * Does nothing if the dump directory has no index.
+ */
+static void dd_index_append(struct dump_dir *dd, const char *line)
+{
+    const int dd_md_fd = dd_get_meta_data_dir_fd(dd, /*no create*/0);
+    if (dd_md_fd < 0)
+        return;
+
+    const int fd = openat(dd_md_fd, META_DATA_FILE_INDEX, O_RDWR | O_APPEND | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+    {
+        if (errno != ENOENT)
+            dd_index_remove(dd);
+        return;
+    }
+
+    char header[sizeof(DD_INDEX_HEADER) + sizeof(long)*3 + 2] = { 0 };
+    unsigned long written_size = 0;
+    struct stat statbuf;
+    const size_t len = strlen(line);
+    if (   fstat(fd, &statbuf) != 0
+        || !S_ISREG(statbuf.st_mode)
+        || statbuf.st_nlink > 1
+        || pread(fd, header, sizeof(header) - 1, 0) <= 0
+        || sscanf(header, DD_INDEX_HEADER" %lu", &written_size) != 1
+        || full_write(fd, line, len) != (ssize_t)len)
+    {
+        close(fd);
+        log_notice("Can't update index of '%s'", dd->dd_dirname);
+        dd_index_remove(dd);
+        return;
+    }
+    close(fd);
+
+    if (statbuf.st_size + len <= 2 * written_size + sizeof(header) + DD_INDEX_MIN_APPENDED_SIZE)
+        return;
+
+    GHashTable *index;
+    if (dd_index_load(dd, &index) == 0)
+        dd_index_save(dd, index);
+    dd_index_free(index);
+}
+
+/* Brings the index entry of the item in sync with the file system after the
+ * item was created, rewritten or deleted. If the type is not
+ * DD_INDEX_TYPE_UNKNOWN, data and size are the new contents of the item.
+ *
+ * Does nothing if the dump directory has no index.
+ */
+static void dd_index_update_item(struct dump_dir *dd, const char *name, char type,
+        const char *data, size_t size)
+{
+    if (!dd->locked)
+    {
+        /* Cannot update the index without the lock */
+        dd_index_remove(dd);
+        return;
+    }
+
+    struct stat statbuf;
+    if (fstatat(dd->dd_fd, name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        if (errno != ENOENT)
+        {
+            dd_index_remove(dd);
+            return;
+        }
+
+        char *line = xasprintf("D %s\n", name);
+        dd_index_append(dd, line);
+        free(line);
+        return;
+    }
+
+    if (!S_ISREG(statbuf.st_mode))
+    {
+        dd_index_remove(dd);
+        return;
+    }
+
+    struct dd_index_item item = {
+        .name = (char *)name,
+        .size = statbuf.st_size,
+        .mtime = statbuf.st_mtim,
+        .type = type,
+        .hash = "-",
+    };
+
+    if (type != DD_INDEX_TYPE_UNKNOWN)
+    {
+        sha1_ctx_t sha1ctx;
+        char hash_bytes[SHA1_RESULT_LEN];
+        sha1_begin(&sha1ctx);
+        sha1_hash(&sha1ctx, data, size);
+        sha1_end(&sha1ctx, hash_bytes);
+        *bin2hex(item.hash, hash_bytes, SHA1_RESULT_LEN) = '\0';
+    }
+
+    struct strbuf *buf = strbuf_new();
+    dd_index_append_item_line(buf, &item);
+    dd_index_append(dd, buf->buf);
+    strbuf_free(buf);
+}
+
 int dd_set_owner(struct dump_dir *dd, uid_t owner)
 {
     /* I was tempted to use the keyword static, but we should have reentracy
@@ -986,7 +1739,10 @@ static struct dump_dir *dd_do_open(struct dump_dir *dd, const char *dir, int fla
     }
 
     errno = 0;
-    if (dd_lock(dd, WAIT_FOR_OTHER_PROCESS_USLEEP, flags) < 0)
+    const int lock_result = (flags & DD_OPEN_SHARED)
+                            ? dd_lock_shared(dd, flags)
+                            : dd_lock(dd, WAIT_FOR_OTHER_PROCESS_USLEEP, flags);
+    if (lock_result < 0)
     {
         if (errno == EISDIR)
         {
@@ -1007,7 +1763,7 @@ static struct dump_dir *dd_do_open(struct dump_dir *dd, const char *dir, int fla
             goto fail_with_close;
         }
 
-        if (!(flags & DD_OPEN_READONLY))
+        if (!(flags & (DD_OPEN_READONLY | DD_OPEN_SHARED)))
         {
             log_debug("'%s' can't be opened for writing", dd->dd_dirname);
             goto fail_with_close;
@@ -1052,7 +1808,12 @@ cant_access:
     }
 
 fail_with_close:
-    dd_close(dd);
+    {
+        /* e.g. EAGAIN of DD_DONT_WAIT_FOR_LOCK for the caller */
+        const int err = errno;
+        dd_close(dd);
+        errno = err;
+    }
     return NULL;
 }
 
@@ -1064,7 +1825,7 @@ struct dump_dir *dd_fdopendir(struct dump_dir *dd, int flags)
     if (dd->dd_fd < 0)
         error_msg_and_die("the dump directory was not initialized yet");
 
-    if (dd->locked)
+    if (dd->locked || dd->dd_rlock_name)
         error_msg_and_die("the dump directory is already locked");
 
     return dd_do_open(dd, NULL, flags);
@@ -1227,6 +1988,13 @@ struct dump_dir *dd_create_skeleton(const char *dir, uid_t uid, mode_t mode, int
         goto fail;
     }
 
+    /* The directory is empty, so is its index. Failing to create the index
+     * is not fatal, readers fall back to walking the directory.
+     */
+    GHashTable *no_items = dd_index_new();
+    dd_index_save(dd, no_items);
+    dd_index_free(no_items);
+
     if (uid != (uid_t)-1L)
     {
         dd->dd_uid = 0;
@@ -1663,6 +2431,98 @@ next:
     return chown_res;
 }
 
+/* Text items keep all bytes >= ' ' and the white-space control characters
+ * ('\t', '\n', '\v', '\f', '\r'). NUL bytes are converted to ' ' and the rest
+ * of the control characters are dropped.
+ */
+static inline bool is_text_control_char(unsigned char ch)
+{
+    return ch < ' ' && (ch < '\t' || ch > '\r');
+}
+
+/* Returns the offset of the first byte for which is_text_control_char()
+ * holds or size if there is none.
+ */
+static size_t find_text_control_char(const char *buf, size_t size)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i last_control = _mm_set1_epi8(' ' - 1);
+    const __m128i first_space = _mm_set1_epi8('\t');
+    const __m128i space_range = _mm_set1_epi8('\r' - '\t');
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+        /* unsigned v <= 0x1F */
+        const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, last_control), v);
+        /* unsigned (v - '\t') <= '\r' - '\t' */
+        const __m128i shifted = _mm_sub_epi8(v, first_space);
+        const __m128i space = _mm_cmpeq_epi8(_mm_min_epu8(shifted, space_range), shifted);
+        const int mask = _mm_movemask_epi8(_mm_andnot_si128(space, control));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < size; ++i)
+        if (is_text_control_char(buf[i]))
+            return i;
+
+    return size;
+}
+
+/* Removes the control characters in place and returns the new size */
+static size_t filter_text_control_chars(char *buf, size_t size)
+{
+    size_t src = find_text_control_char(buf, size);
+    size_t dst = src;
+    while (src < size)
+    {
+        /* buf[src] is a control character */
+        if (buf[src] == '\0')
+            buf[dst++] = ' ';
+        ++src;
+
+        const size_t next = src + find_text_control_char(buf + src, size - src);
+        if (dst != src)
+            memmove(buf + dst, buf + src, next - src);
+        dst += next - src;
+        src = next;
+    }
+
+    return dst;
+}
+
+/* Reads the whole file into a malloced buffer with room for two more bytes */
+static char *read_text_from_file_descriptor(int fd, size_t *size)
+{
+    struct stat st;
+    size_t capacity = 4096;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size >= capacity)
+        /* + 1 detects EOF without another reallocation */
+        capacity = st.st_size + 1;
+
+    char *buf = xmalloc(capacity + 2);
+    size_t len = 0;
+    while (1)
+    {
+        if (len == capacity)
+        {
+            capacity *= 2;
+            buf = xrealloc(buf, capacity + 2);
+        }
+
+        const ssize_t r = safe_read(fd, buf + len, capacity - len);
+        /* Read errors are treated like EOF, we return what we have got */
+        if (r <= 0)
+            break;
+
+        len += r;
+    }
+
+    *size = len;
+    return buf;
+}
+
 static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
 {
     if (fd == -1)
@@ -1673,29 +2533,23 @@ static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
     }
 
     /* Why? Because half a million read syscalls of one byte each isn't fun.
-     * FILE-based IO buffers reads.
+     * The file is read at once into a buffer sized according to fstat.
      */
-    FILE *fp = fdopen(fd, "r");
-    if (!fp)
-        die_out_of_memory();
+    size_t len = 0;
+    char *buf = read_text_from_file_descriptor(fd, &len);
+    close(fd);
 
-    struct strbuf *buf_content = strbuf_new();
-    int oneline = 0;
-    int ch;
-    while ((ch = fgetc(fp)) != EOF)
-    {
 //TODO? \r -> \n?
 //TODO? strip trailing spaces/tabs?
-        if (ch == '\n')
-            oneline = (oneline << 1) | 1;
-        if (ch == '\0')
-            ch = ' ';
-        if (isspace(ch) || ch >= ' ') /* used !iscntrl, but it failed on unicode */
-            strbuf_append_char(buf_content, ch);
-    }
-    fclose(fp); /* this also closes fd */
+    len = filter_text_control_chars(buf, len);
 
-    char last = oneline != 0 ? buf_content->buf[buf_content->len - 1] : 0;
+    /* 0 - no '\n', 1 - exactly one '\n', 2 - more of them */
+    int oneline = 0;
+    const char *nl = memchr(buf, '\n', len);
+    if (nl != NULL)
+        oneline = memchr(nl + 1, '\n', len - (nl + 1 - buf)) == NULL ? 1 : 2;
+
+    char last = oneline != 0 ? buf[len - 1] : 0;
     if (last == '\n')
     {
         /* If file contains exactly one '\n' and it is at the end, remove it.
@@ -1703,7 +2557,7 @@ static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
          * short string items in dump dirs.
          */
         if (oneline == 1)
-            buf_content->buf[--buf_content->len] = '\0';
+            --len;
     }
     else /* last != '\n' */
     {
@@ -1713,10 +2567,11 @@ static char *load_text_from_file_descriptor(int fd, const char *path, int flags)
         /* oneline=1: "qwe\nrty" - two lines in fact */
         /* oneline>1: "qwe\nrty\uio" */
         if (oneline >= 1)
-            strbuf_append_char(buf_content, '\n');
+            buf[len++] = '\n';
     }
+    buf[len] = '\0';
 
-    return strbuf_free_nobuf(buf_content);
+    return buf;
 }
 
 static char *load_text_file_at(int dir_fd, const char *name, unsigned flags)
@@ -1895,7 +2750,9 @@ void dd_save_text(struct dump_dir *dd, const char *name, const char *data)
     if (!dd_validate_element_name(name))
         error_msg_and_die("Cannot save text. '%s' is not a valid file name", name);
 
-    save_binary_file_at(dd->dd_fd, name, data, strlen(data), dd->dd_uid, dd->dd_gid, dd->mode);
+    const size_t size = strlen(data);
+    const bool saved = save_binary_file_at(dd->dd_fd, name, data, size, dd->dd_uid, dd->dd_gid, dd->mode);
+    dd_index_update_item(dd, name, saved ? DD_INDEX_TYPE_TEXT : DD_INDEX_TYPE_UNKNOWN, data, size);
 }
 
 void dd_save_binary(struct dump_dir* dd, const char* name, const char* data, unsigned size)
@@ -1906,7 +2763,8 @@ void dd_save_binary(struct dump_dir* dd, const char* name, const char* data, uns
     if (!dd_validate_element_name(name))
         error_msg_and_die("Cannot save binary. '%s' is not a valid file name", name);
 
-    save_binary_file_at(dd->dd_fd, name, data, size, dd->dd_uid, dd->dd_gid, dd->mode);
+    const bool saved = save_binary_file_at(dd->dd_fd, name, data, size, dd->dd_uid, dd->dd_gid, dd->mode);
+    dd_index_update_item(dd, name, saved ? DD_INDEX_TYPE_BINARY : DD_INDEX_TYPE_UNKNOWN, data, size);
 }
 
 int dd_item_stat(struct dump_dir *dd, const char *name, struct stat *statbuf)
@@ -1970,6 +2828,9 @@ int dd_delete_item(struct dump_dir *dd, const char *name)
             perror_msg("Can't delete file '%s'", name);
     }
 
+    if (res == 0)
+        dd_index_update_item(dd, name, DD_INDEX_TYPE_UNKNOWN, NULL, 0);
+
     return res;
 }
 
@@ -1988,7 +2849,11 @@ int dd_open_item(struct dump_dir *dd, const char *name, int flag)
         error_msg_and_die("dump_dir is not locked"); /* bug */
 
     if (flag == O_RDWR)
+    {
+        /* We cannot see what the caller writes to the file */
+        dd_index_remove(dd);
         return create_new_file_at(dd->dd_fd, O_RDWR, name, dd->dd_uid, dd->dd_gid, dd->mode);
+    }
 
     error_msg("invalid open item flag");
     return -ENOTSUP;
@@ -2024,6 +2889,14 @@ int dd_get_items_count(struct dump_dir *dd)
 {
     int retval = 0;
 
+    GHashTable *index;
+    if (dd_index_load(dd, &index) == 0)
+    {
+        const guint length = g_hash_table_size(index);
+        dd_index_free(index);
+        return length > INT_MAX ? -E2BIG : (int)length;
+    }
+
     if (dd_init_next_file(dd) == NULL)
         return -EIO;
 
@@ -2046,6 +2919,27 @@ off_t dd_compute_size(struct dump_dir *dd, int flags)
 {
     off_t retval = 0;
 
+    GHashTable *index;
+    if (dd_index_load(dd, &index) == 0)
+    {
+        GHashTableIter iter;
+        gpointer item;
+        g_hash_table_iter_init(&iter, index);
+        while (g_hash_table_iter_next(&iter, NULL, &item))
+        {
+            retval += ((struct dd_index_item *)item)->size;
+            /* Check overflow */
+            if (retval < 0)
+            {
+                retval = -E2BIG;
+                break;
+            }
+        }
+
+        dd_index_free(index);
+        return retval;
+    }
+
     if (dd_init_next_file(dd) == NULL)
         return -EIO;
 
@@ -2073,6 +2967,105 @@ finito:
     return retval;
 }
 
+/* Re-creates the index from the items of the directory and stores the new
+ * index in the index parameter on success.
+ */
+static int dd_index_rebuild(struct dump_dir *dd, GHashTable **index)
+{
+    *index = NULL;
+
+    /* Text/binary type and hash of unchanged items survive the rebuild */
+    GHashTable *old_index;
+    dd_index_read(dd, &old_index);
+
+    int retval = 0;
+    GHashTable *new_index = dd_index_new();
+
+    if (dd_init_next_file(dd) == NULL)
+    {
+        retval = -EIO;
+        goto finito;
+    }
+
+    struct stat statbuf;
+    struct dirent *dent;
+    while (_dd_get_next_file_dent(dd, &dent))
+    {
+        if (!dd_validate_element_name(dent->d_name))
+        {
+            error_msg("Can't index '%s' at '%s': not a valid item name", dent->d_name, dd->dd_dirname);
+            retval = -EINVAL;
+            break;
+        }
+
+        if (fstatat(dd->dd_fd, dent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            retval = -errno;
+            perror_msg("Can't index '%s' at '%s'", dent->d_name, dd->dd_dirname);
+            break;
+        }
+
+        struct dd_index_item *item = xzalloc(sizeof(*item));
+        item->name = xstrdup(dent->d_name);
+        item->size = statbuf.st_size;
+        item->mtime = statbuf.st_mtim;
+        item->type = DD_INDEX_TYPE_UNKNOWN;
+        strcpy(item->hash, "-");
+
+        const struct dd_index_item *old = old_index ? g_hash_table_lookup(old_index, item->name) : NULL;
+        if (   old != NULL
+            && old->size == item->size
+            && old->mtime.tv_sec == item->mtime.tv_sec
+            && old->mtime.tv_nsec == item->mtime.tv_nsec)
+        {
+            item->type = old->type;
+            strcpy(item->hash, old->hash);
+        }
+
+        g_hash_table_replace(new_index, item->name, item);
+    }
+
+    dd_clear_next_file(dd);
+
+    if (retval == 0)
+        retval = dd_index_save(dd, new_index);
+    else
+        dd_index_remove(dd);
+
+finito:
+    if (retval == 0)
+        *index = new_index;
+    else
+        dd_index_free(new_index);
+    dd_index_free(old_index);
+    return retval;
+}
+
+int dd_rebuild_index(struct dump_dir *dd)
+{
+    if (!dd->locked)
+        error_msg_and_die("dump_dir is not opened"); /* bug */
+
+    GHashTable *index;
+    const int retval = dd_index_rebuild(dd, &index);
+    dd_index_free(index);
+    return retval;
+}
+
+int dump_dir_remove_index(const char *dirname)
+{
+    char *index_path = concat_path_file(dirname, META_DATA_DIR_NAME"/"META_DATA_FILE_INDEX);
+    int retval = 0;
+    if (unlink(index_path) != 0 && errno != ENOENT)
+    {
+        retval = -errno;
+        perror_msg("Can't remove index '%s'", index_path);
+    }
+
+    free(index_path);
+    return retval;
+}
+
 DIR *dd_init_next_file(struct dump_dir *dd)
 {
 //    if (!dd->locked)
@@ -2360,6 +3353,8 @@ int dd_copy_file(struct dump_dir *dd, const char *name, const char *source_path)
     else
         log_debug("copied %li bytes", (unsigned long)copied);
 
+    dd_index_update_item(dd, name, DD_INDEX_TYPE_UNKNOWN, NULL, 0);
+
     return copied < 0;
 }
 
@@ -2382,6 +3377,8 @@ int dd_copy_file_at(struct dump_dir *dd, const char *name, int src_dir_fd, const
     else
         log_debug("copied %li bytes", (unsigned long)copied);
 
+    dd_index_update_item(dd, name, DD_INDEX_TYPE_UNKNOWN, NULL, 0);
+
     return copied < 0;
 }
 
@@ -2401,66 +3398,39 @@ int dd_copy_file_unpack(struct dump_dir *dd, const char *name, const char *sourc
     else
         log_debug("unpackaged file '%s'", source_path);
 
+    dd_index_update_item(dd, name, DD_INDEX_TYPE_UNKNOWN, NULL, 0);
+
     return copied < 0;
 
 }
 
 /* flags - for future needs */
-int dd_create_archive(struct dump_dir *dd, const char *archive_name,
+int dd_write_archive(struct dump_dir *dd, int fd, const char *archive_name,
         const_string_vector_const_ptr_t exclude_elements, int flags)
 {
-    if (suffixcmp(archive_name, ".tar.gz") != 0)
+    const int format = archive_compression_format(archive_name);
+    if (format < 0)
         return -ENOSYS;
 
-    int result = 0;
-    pid_t child;
-    TAR* tar = NULL;
-    int pipe_from_parent_to_child[2];
-    xpipe(pipe_from_parent_to_child);
-    child = fork();
-    if (child < 0)
-    {
-        result = -errno;
-        /* Don't die, let the caller to execute his clean-up code. */
-        perror_msg("vfork");
-        return result;
-    }
-    if (child == 0)
-    {
-        /* child */
-        close(pipe_from_parent_to_child[1]);
-        xmove_fd(pipe_from_parent_to_child[0], 0);
-
-        int fd = open(archive_name, O_WRONLY | O_CREAT | O_EXCL, 0600);
-        if (fd < 0)
-        {
-            /* This r might interfer with exit status of gzip, but it is
-             * very unlikely (man 1 gzip):
-             *   Exit status is normally 0; if an error occurs, exit status is
-             *   1. If a warning occurs, exit status is 2.
-             */
-            result = errno == EEXIST ? 100 : 3;
-            perror_msg("Can't open '%s'", archive_name);
-            exit(result);
-        }
-
-        xmove_fd(fd, 1);
-        execlp("gzip", "gzip", NULL);
-        perror_msg_and_die("Can't execute '%s'", "gzip");
-    }
-    close(pipe_from_parent_to_child[0]);
-
-    /* If child died (say, in xopen), then parent might get SIGPIPE.
-     * We want to properly unlock dd, therefore we must not die on SIGPIPE:
+    /* Compress in this process, but in a separate thread, so that libtar
+     * can keep writing to a plain file descriptor.
      */
-    sighandler_t old_handler = signal(SIGPIPE, SIG_IGN);
+    struct compressor *compressor = NULL;
+    const int tar_fd = compressor_start(format, fd, &compressor);
+    if (tar_fd < 0)
+        return tar_fd;
+
+    int result = 0;
 
     /* Create tar writer object */
-    if (tar_fdopen(&tar, pipe_from_parent_to_child[1], archive_name,
+    TAR* tar = NULL;
+    if (tar_fdopen(&tar, tar_fd, archive_name,
                 /*fileops:(standard)*/ NULL, O_WRONLY | O_CREAT, 0644, TAR_GNU) != 0)
     {
         result = -errno;
         log_warning(_("Failed to open TAR writer"));
+        tar = NULL;
+        close(tar_fd);
         goto finito;
     }
 
@@ -2491,36 +3461,59 @@ int dd_create_archive(struct dump_dir *dd, const char *archive_name,
     }
 
 finito:
-    signal(SIGPIPE, old_handler);
-
     if (tar != NULL && tar_close(tar) != 0)
     {
         result = -errno;
         log_warning(_("Failed to close TAR writer"));
     }
 
-    /* ...and check that gzip child finished successfully */
-    int status;
-    safe_waitpid(child, &status, 0);
-    if (status != 0)
+    /* ...and check that the compressor finished successfully */
+    if (compressor_finish(compressor) != 0)
     {
-        result = -ECHILD;
-        if (WIFSIGNALED(status))
-            log_warning(_("gzip killed with signal %d"), WTERMSIG(status));
-        else if (WIFEXITED(status))
-        {
-            if (WEXITSTATUS(status) == 100)
-                result = -EEXIST;
-            else
-                log_warning(_("gzip exited with %d"), WEXITSTATUS(status));
-        }
-        else
-            log_warning(_("gzip process failed"));
+        if (result == 0)
+            result = -ECHILD;
+        log_warning(_("Failed to compress the archive"));
     }
 
     return result;
 }
 
+int dd_create_archive(struct dump_dir *dd, const char *archive_name,
+        const_string_vector_const_ptr_t exclude_elements, int flags)
+{
+    if (archive_compression_format(archive_name) < 0)
+        return -ENOSYS;
+
+    int result = 0;
+    const int archive_fd = open(archive_name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (archive_fd < 0)
+    {
+        result = -errno;
+        perror_msg("Can't open '%s'", archive_name);
+        return result;
+    }
+
+    /* If compressor failed, then we might get SIGPIPE.
+     * We want to properly unlock dd, therefore we must not die on SIGPIPE:
+     */
+    sighandler_t old_handler = signal(SIGPIPE, SIG_IGN);
+
+    result = dd_write_archive(dd, archive_fd, archive_name, exclude_elements, flags);
+
+    signal(SIGPIPE, old_handler);
+
+    if (close(archive_fd) != 0 && result == 0)
+    {
+        result = -errno;
+        perror_msg("Can't close '%s'", archive_name);
+    }
+
+    if (result != 0)
+        unlink(archive_name);
+
+    return result;
+}
+
 off_t dd_copy_fd(struct dump_dir *dd, const char *name, int fd, int copy_flags, off_t maxsize)
 {
     if (!dd_validate_element_name(name))
@@ -2543,5 +3536,7 @@ off_t dd_copy_fd(struct dump_dir *dd, const char *name, int fd, int copy_flags,
     else
         log_debug("Saved %lu Bytes", (unsigned long)read);
 
+    dd_index_update_item(dd, name, DD_INDEX_TYPE_UNKNOWN, NULL, 0);
+
     return read;
 }
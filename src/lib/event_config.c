@@ -22,6 +22,16 @@
 GHashTable *g_event_config_list;
 static GHashTable *g_event_config_symlinks;
 
+/* Index of the options of an event by name */
+struct event_option_index
+{
+    GHashTable *links; /* eo_name -> the link of the option in options */
+    /* The list the index was built for. The list can be modified directly
+     * (e.g. by the UI), the index is rebuilt if it has been. */
+    GList *head;
+    GList *tail;
+};
+
 invalid_option_t *new_invalid_option(void)
 {
     return xzalloc(sizeof(invalid_option_t));
@@ -93,6 +103,69 @@ void ec_print(event_config_t *ec)
         );
 }
 
+static void free_event_option_index(struct event_option_index *index)
+{
+    if (!index)
+        return;
+
+    g_hash_table_destroy(index->links);
+    free(index);
+}
+
+static struct event_option_index *get_event_option_index(event_config_t *ec)
+{
+    struct event_option_index *index = ec->ec_option_index;
+    if (index
+     && index->head == ec->options
+     && (index->tail ? index->tail->next == NULL : ec->options == NULL))
+        return index;
+
+    free_event_option_index(index);
+    index = ec->ec_option_index = xzalloc(sizeof(*index));
+    index->links = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+    index->head = ec->options;
+
+    for (GList *link = ec->options; link; link = g_list_next(link))
+    {
+        index->tail = link;
+
+        /* The first one wins as in get_event_option_from_list() */
+        event_option_t *opt = link->data;
+        if (opt->eo_name && !g_hash_table_lookup(index->links, opt->eo_name))
+            g_hash_table_insert(index->links, xstrdup(opt->eo_name), link);
+    }
+
+    return index;
+}
+
+event_option_t *ec_get_option(event_config_t *ec, const char *name)
+{
+    GList *link = g_hash_table_lookup(get_event_option_index(ec)->links, name);
+    return link ? link->data : NULL;
+}
+
+void ec_add_option(event_config_t *ec, event_option_t *opt)
+{
+    struct event_option_index *index = get_event_option_index(ec);
+
+    GList *link = opt->eo_name ? g_hash_table_lookup(index->links, opt->eo_name) : NULL;
+    if (link)
+    {
+        free_event_option(link->data);
+        link->data = opt;
+        return;
+    }
+
+    /* g_list_append() from the last link doesn't walk the list */
+    if (index->tail)
+        index->tail = g_list_append(index->tail, opt)->next;
+    else
+        index->head = index->tail = ec->options = g_list_append(NULL, opt);
+
+    if (opt->eo_name)
+        g_hash_table_insert(index->links, xstrdup(opt->eo_name), index->tail);
+}
+
 bool ec_restricted_access_enabled(event_config_t *ec)
 {
     if (!ec->ec_supports_restricted_access)
@@ -109,7 +182,7 @@ bool ec_restricted_access_enabled(event_config_t *ec)
         return false;
     }
 
-    event_option_t *eo = get_event_option_from_list(ec->ec_restricted_access_option, ec->options);
+    event_option_t *eo = ec_get_option(ec, ec->ec_restricted_access_option);
     if (eo == NULL)
     {
         log_warning("Event '%s' supports restricted access but the option is not defined", ec_get_name(ec));
@@ -162,6 +235,7 @@ void free_event_config(event_config_t *p)
     free(p->ec_restricted_access_option);
     g_list_free_full(p->ec_imported_event_names, free);
     g_list_free_full(p->options, (GDestroyNotify)free_event_option);
+    free_event_option_index(p->ec_option_index);
 
     free(p);
 }
@@ -181,63 +255,151 @@ event_option_t *get_event_option_from_list(const char *name, GList *options)
     return NULL;
 }
 
-static void load_config_files(const char *dir_path)
+/* Files of an event which has not been loaded yet */
+struct event_config_files
 {
-    GList *conf_files = get_file_list(dir_path, "conf");
-    while (conf_files != NULL)
+    char *xml_path;
+    GList *conf_paths; /* in the order of loading */
+};
+
+/* Event name -> struct event_config_files, see load_event_config_data_lazily() */
+static GHashTable *g_event_config_files;
+/* All indexed events have been loaded, the reloaded ones must be loaded too */
+static bool g_event_config_loaded_all;
+
+static void free_event_config_files(struct event_config_files *files)
+{
+    if (!files)
+        return;
+
+    free(files->xml_path);
+    g_list_free_full(files->conf_paths, free);
+    free(files);
+}
+
+static void index_event_config_files(const char *dir_path, const char *ext)
+{
+    GList *files = get_file_list(dir_path, ext);
+    while (files != NULL)
     {
-        file_obj_t *file = (file_obj_t *)conf_files->data;
-        char *fullpath = file->fullpath;
-        char *filename = file->filename;
+        file_obj_t *file = (file_obj_t *)files->data;
 
-        event_config_t *event_config = get_event_config(filename);
-        bool new_config = (!event_config);
-        if (new_config)
-            event_config = new_event_config(filename);
+        struct event_config_files *event_files = g_hash_table_lookup(g_event_config_files, file->filename);
+        if (!event_files)
+        {
+            event_files = xzalloc(sizeof(*event_files));
+            g_hash_table_replace(g_event_config_files, xstrdup(file->filename), event_files);
+        }
 
-        map_string_t *keys_and_values = new_map_string();
+        if (strcmp(ext, "xml") == 0)
+        {
+            free(event_files->xml_path);
+            event_files->xml_path = xstrdup(file->fullpath);
+        }
+        else
+            event_files->conf_paths = g_list_append(event_files->conf_paths, xstrdup(file->fullpath));
 
-        load_conf_file(fullpath, keys_and_values, /*skipKeysWithoutValue:*/ false);
+        free_file_obj(file);
+        files = g_list_delete_link(files, files);
+    }
+}
 
-        /* Insert or replace every key/value from keys_and_values to event_config->option */
-        map_string_iter_t iter;
-        const char *name;
-        const char *value;
-        init_map_string_iter(&iter, keys_and_values);
-        while (next_map_string_iter(&iter, &name, &value))
+/* Insert or replace every key/value from keys_and_values to event_config->option */
+static void add_event_options(event_config_t *event_config, map_string_t *keys_and_values)
+{
+    map_string_iter_t iter;
+    const char *name;
+    const char *value;
+    init_map_string_iter(&iter, keys_and_values);
+    while (next_map_string_iter(&iter, &name, &value))
+    {
+        event_option_t *opt = ec_get_option(event_config, name);
+        if (opt)
         {
-            event_option_t *opt;
-            GList *elem = g_list_find_custom(event_config->options, name,
-                                            cmp_event_option_name_with_string);
-            if (elem)
-            {
-                opt = elem->data;
-                // log_warning("conf: replacing '%s' value:'%s'->'%s'", name, opt->value, value);
-                free(opt->eo_value);
-            }
-            else
-            {
-                // log_warning("conf: new value %s='%s'", name, value);
-                opt = new_event_option();
-                opt->eo_name = xstrdup(name);
-            }
+            // log_warning("conf: replacing '%s' value:'%s'->'%s'", name, opt->value, value);
+            free(opt->eo_value);
+            opt->eo_value = xstrdup(value);
+        }
+        else
+        {
+            // log_warning("conf: new value %s='%s'", name, value);
+            opt = new_event_option();
+            opt->eo_name = xstrdup(name);
             opt->eo_value = xstrdup(value);
-            if (!elem)
-                event_config->options = g_list_append(event_config->options, opt);
+            ec_add_option(event_config, opt);
         }
+    }
+}
 
-        free_map_string(keys_and_values);
+/* Loads the indexed events from their .xml and .conf files.
+ *
+ * The .conf files of all events are loaded at once, the options from later
+ * directories replace the options from the earlier ones.
+ */
+static void load_indexed_event_configs(GList *event_names)
+{
+    GList *configs = NULL;
+    GList *conf_paths = NULL;
+    GList *conf_configs = NULL;
 
-        if (new_config)
-            g_hash_table_replace(g_event_config_list, xstrdup(ec_get_name(event_config)), event_config);
+    for (GList *iter = event_names; iter != NULL; iter = g_list_next(iter))
+    {
+        const char *name = iter->data;
+        struct event_config_files *event_files = g_hash_table_lookup(g_event_config_files, name);
 
-        free_file_obj(file);
-        conf_files = g_list_delete_link(conf_files, conf_files);
+        event_config_t *event_config = new_event_config(name);
+        configs = g_list_prepend(configs, event_config);
+
+        if (event_files->xml_path)
+            load_event_description_from_file(event_config, event_files->xml_path);
+
+        for (GList *conf = event_files->conf_paths; conf != NULL; conf = g_list_next(conf))
+        {
+            conf_paths = g_list_prepend(conf_paths, conf->data);
+            conf_configs = g_list_prepend(conf_configs, event_config);
+        }
+    }
+    conf_paths = g_list_reverse(conf_paths);
+    conf_configs = g_list_reverse(conf_configs);
+
+    const unsigned count = g_list_length(conf_paths);
+    const char **paths = xzalloc((count + 1) * sizeof(paths[0]));
+    map_string_t **settings = xmalloc(count * sizeof(settings[0]));
+
+    unsigned i = 0;
+    for (GList *iter = conf_paths; iter != NULL; iter = g_list_next(iter), ++i)
+    {
+        paths[i] = iter->data;
+        settings[i] = new_map_string();
     }
+
+    load_conf_files(paths, settings, /*skipKeysWithoutValue:*/ false);
+
+    i = 0;
+    for (GList *iter = conf_configs; iter != NULL; iter = g_list_next(iter), ++i)
+    {
+        add_event_options(iter->data, settings[i]);
+        free_map_string(settings[i]);
+    }
+
+    free(settings);
+    free(paths);
+    g_list_free(conf_configs);
+    g_list_free(conf_paths);
+
+    for (GList *iter = configs; iter != NULL; iter = g_list_next(iter))
+    {
+        event_config_t *event_config = iter->data;
+        g_hash_table_replace(g_event_config_list, xstrdup(ec_get_name(event_config)), event_config);
+    }
+    g_list_free(configs);
+
+    for (GList *iter = event_names; iter != NULL; iter = g_list_next(iter))
+        g_hash_table_remove(g_event_config_files, iter->data);
 }
 
-/* (Re)loads data from /etc/abrt/events/foo.{xml,conf} and $XDG_CACHE_HOME/abrt/events/foo.conf */
-GHashTable *load_event_config_data(void)
+/* Indexes /etc/abrt/events/foo.{xml,conf} and $XDG_CACHE_HOME/abrt/events/foo.conf */
+GHashTable *load_event_config_data_lazily(void)
 {
     free_event_config_data();
 
@@ -255,25 +417,13 @@ GHashTable *load_event_config_data(void)
                 /*key_destroy_func:*/ free,
                 /*value_destroy_func:*/ free
         );
-
-    GList *event_files = get_file_list(EVENTS_DIR, "xml");
-    while (event_files)
-    {
-        file_obj_t *file = (file_obj_t *)event_files->data;
-
-        event_config_t *event_config = get_event_config(file->filename);
-        bool new_config = (!event_config);
-        if (new_config)
-           event_config = new_event_config(file->filename);
-
-        load_event_description_from_file(event_config, file->fullpath);
-
-        if (new_config)
-            g_hash_table_replace(g_event_config_list, xstrdup(ec_get_name(event_config)), event_config);
-
-        free_file_obj(file);
-        event_files = g_list_delete_link(event_files, event_files);
-    }
+    if (!g_event_config_files)
+        g_event_config_files = g_hash_table_new_full(
+                /*hash_func*/ g_str_hash,
+                /*key_equal_func:*/ g_str_equal,
+                /*key_destroy_func:*/ free,
+                /*value_destroy_func:*/ (GDestroyNotify) free_event_config_files
+        );
 
     /* EVENTS_DIR      -> /usr/share/libreport/events/$EVENT_NAME.xml
      *   - event xml definition files
@@ -283,19 +433,93 @@ GHashTable *load_event_config_data(void)
      *
      * https://fedorahosted.org/abrt/wiki/AbrtConfiguration#Adjustingpluginconfiguration
      */
-    load_config_files(EVENTS_CONF_DIR);
+    index_event_config_files(EVENTS_DIR, "xml");
+    index_event_config_files(EVENTS_CONF_DIR, "conf");
 
     char *cachedir;
     cachedir = concat_path_file(g_get_user_cache_dir(), "abrt/events");
-    load_config_files(cachedir);
+    index_event_config_files(cachedir, "conf");
     free(cachedir);
 
     return g_event_config_list;
 }
 
+/* Loads the indexed events which have not been loaded yet */
+GHashTable *load_all_event_config_data(void)
+{
+    if (!g_event_config_list)
+        return load_event_config_data();
+
+    GList *event_names = g_hash_table_get_keys(g_event_config_files);
+    /* The keys are freed when the events are loaded */
+    for (GList *iter = event_names; iter != NULL; iter = g_list_next(iter))
+        iter->data = xstrdup(iter->data);
+
+    load_indexed_event_configs(event_names);
+    g_list_free_full(event_names, free);
+    g_event_config_loaded_all = true;
+
+    return g_event_config_list;
+}
+
+/* (Re)loads data from /etc/abrt/events/foo.{xml,conf} and $XDG_CACHE_HOME/abrt/events/foo.conf */
+GHashTable *load_event_config_data(void)
+{
+    load_event_config_data_lazily();
+    return load_all_event_config_data();
+}
+
+void reload_event_config(const char *event_name)
+{
+    /* Nothing has been loaded by load_event_config_data*() */
+    if (!g_event_config_list || !g_event_config_files)
+        return;
+
+    struct event_config_files *event_files = xzalloc(sizeof(*event_files));
+
+    char *path = xasprintf(EVENTS_DIR"/%s.xml", event_name);
+    if (access(path, F_OK) == 0)
+        event_files->xml_path = path;
+    else
+        free(path);
+
+    char *cachedir = concat_path_file(g_get_user_cache_dir(), "abrt/events");
+    const char *const conf_dirs[] = { EVENTS_CONF_DIR, cachedir, NULL };
+    for (const char *const *dir = conf_dirs; *dir; ++dir)
+    {
+        path = xasprintf("%s/%s.conf", *dir, event_name);
+        if (access(path, F_OK) == 0)
+            event_files->conf_paths = g_list_append(event_files->conf_paths, path);
+        else
+            free(path);
+    }
+    free(cachedir);
+
+    const bool loaded = g_hash_table_lookup(g_event_config_list, event_name);
+    if (!event_files->xml_path && !event_files->conf_paths)
+    {
+        log_info("Removing event '%s'", event_name);
+        free_event_config_files(event_files);
+        g_hash_table_remove(g_event_config_files, event_name);
+        g_hash_table_remove(g_event_config_list, event_name);
+        return;
+    }
+
+    g_hash_table_replace(g_event_config_files, xstrdup(event_name), event_files);
+    if (loaded || g_event_config_loaded_all)
+    {
+        log_info("%s event '%s'", loaded ? "Reloading" : "Loading", event_name);
+        /* The new config replaces and frees the old one */
+        GList *event_names = g_list_prepend(NULL, (gpointer)event_name);
+        load_indexed_event_configs(event_names);
+        g_list_free(event_names);
+    }
+}
+
 /* Frees all loaded data */
 void free_event_config_data(void)
 {
+    g_event_config_loaded_all = false;
     if (g_event_config_list)
     {
         g_hash_table_destroy(g_event_config_list);
@@ -306,6 +530,11 @@ void free_event_config_data(void)
         g_hash_table_destroy(g_event_config_symlinks);
         g_event_config_symlinks = NULL;
     }
+    if (g_event_config_files)
+    {
+        g_hash_table_destroy(g_event_config_files);
+        g_event_config_files = NULL;
+    }
 }
 
 event_config_t *get_event_config(const char *name)
@@ -318,7 +547,18 @@ event_config_t *get_event_config(const char *name)
         if (link)
             name = link;
     }
-    return g_hash_table_lookup(g_event_config_list, name);
+
+    event_config_t *event_config = g_hash_table_lookup(g_event_config_list, name);
+    if (!event_config && g_event_config_files && g_hash_table_lookup(g_event_config_files, name))
+    {
+        GList *event_names = g_list_prepend(NULL, (gpointer)name);
+        load_indexed_event_configs(event_names);
+        g_list_free(event_names);
+
+        event_config = g_hash_table_lookup(g_event_config_list, name);
+    }
+
+    return event_config;
 }
 
 GList *export_event_config(const char *event_name)
@@ -369,6 +609,54 @@ GList *export_event_config(const char *event_name)
     return env_list;
 }
 
+/* Collects the variables in the order export_event_config() sets them,
+ * the later values replace the earlier ones */
+static void add_event_config_env(const char *event_name, map_string_t *vars, GList **names)
+{
+    event_config_t *config = get_event_config(event_name);
+    if (!config)
+        return;
+
+    for (GList *imported = config->ec_imported_event_names; imported; imported = g_list_next(imported))
+        add_event_config_env(/*Event name*/imported->data, vars, names);
+
+    for (GList *lopt = config->options; lopt; lopt = g_list_next(lopt))
+    {
+        event_option_t *opt = lopt->data;
+        if (!opt->eo_value)
+            continue;
+
+        if (!get_map_string_item_or_NULL(vars, opt->eo_name))
+            /* The names are owned by the options */
+            *names = g_list_prepend(*names, opt->eo_name);
+
+        replace_map_string_item(vars, xstrdup(opt->eo_name), xstrdup(opt->eo_value));
+    }
+}
+
+char **get_event_config_env_vec(const char *event_name)
+{
+    map_string_t *vars = new_map_string();
+    GList *names = NULL;
+    add_event_config_env(event_name, vars, &names);
+
+    names = g_list_reverse(names);
+    char **env_vec = xmalloc((g_list_length(names) + 1) * sizeof(env_vec[0]));
+    char **env = env_vec;
+    for (GList *iter = names; iter; iter = g_list_next(iter))
+    {
+        const char *name = iter->data;
+        log_debug("Exporting '%s=%s'", name, get_map_string_item_or_NULL(vars, name));
+        *env++ = xasprintf("%s=%s", name, get_map_string_item_or_NULL(vars, name));
+    }
+    *env = NULL;
+
+    g_list_free(names);
+    free_map_string(vars);
+
+    return env_vec;
+}
+
 /*
  * Goes through given list and calls unsetnev() for each list item.
  *
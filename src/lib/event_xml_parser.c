@@ -117,13 +117,6 @@ static char *get_element_lang(struct my_parse_data *parse_data, const gchar **at
     return NULL;
 }
 
-static int cmp_event_option_name_with_string(gconstpointer a, gconstpointer b)
-{
-    const event_option_t *evopt = a;
-    /* "When it is not a match?" */
-    return !evopt->eo_name || strcmp(evopt->eo_name, (char *)b) != 0;
-}
-
 static void consume_cur_option(struct my_parse_data *parse_data)
 {
     event_option_t *opt = parse_data->cur_option.values;
@@ -140,11 +133,10 @@ static void consume_cur_option(struct my_parse_data *parse_data)
     if (!opt->eo_name)
         opt->eo_name = xasprintf("%u", (unsigned)g_list_length(event_config->values->options));
 
-    GList *elem = g_list_find_custom(event_config->values->options, opt->eo_name, cmp_event_option_name_with_string);
-    if (elem)
+    event_option_t *old_opt = ec_get_option(event_config->values, opt->eo_name);
+    if (old_opt)
     {
         /* we already have option with such name */
-        event_option_t *old_opt = elem->data;
         if (old_opt->eo_value)
         {
             /* ...and it already has a value, which
@@ -155,14 +147,12 @@ static void consume_cur_option(struct my_parse_data *parse_data)
             old_opt->eo_value = NULL;
         }
         //log_warning("xml: replacing '%s' value:'%s'->'%s'", opt->eo_name, old_opt->eo_value, opt->eo_value);
-        free_event_option(old_opt);
-        elem->data = opt;
-    }
-    else
-    {
-        //log_warning("xml: new value %s='%s'", opt->eo_name, opt->eo_value);
-        event_config->values->options = g_list_append(event_config->values->options, opt);
     }
+    //else
+    //    log_warning("xml: new value %s='%s'", opt->eo_name, opt->eo_value);
+
+    /* Replaces and frees old_opt */
+    ec_add_option(event_config->values, opt);
 }
 
 // Called for opening tags <foo bar="baz">
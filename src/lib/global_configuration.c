@@ -86,6 +86,25 @@ bool load_global_configuration_from_dirs(const char *dirs[], int dir_flags[])
     return true;
 }
 
+bool reload_global_configuration(void)
+{
+    if (s_global_settings == NULL)
+        return false;
+
+    /* Keep the current settings if the new ones are invalid */
+    map_string_t *old_settings = s_global_settings;
+    s_global_settings = NULL;
+
+    if (!load_global_configuration())
+    {
+        s_global_settings = old_settings;
+        return false;
+    }
+
+    free_map_string(old_settings);
+    return true;
+}
+
 void free_global_configuration(void)
 {
     if (s_global_settings != NULL)
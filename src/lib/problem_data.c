@@ -16,13 +16,101 @@
     with this program; if not, write to the Free Software Foundation, Inc.,
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "internal_libreport.h"
 
+/* A dump directory the lazy items are read from. The directory is not kept
+ * opened, each item opens it with a shared lock only while reading its
+ * content, so other processes are not blocked by unloaded items. */
+struct lazy_dump_dir
+{
+    unsigned refs;
+    char *dir_name;
+    /* Identifies the directory the items were registered from */
+    dev_t dev;
+    ino_t ino;
+};
+
+/* An item registered by a lazy load, see CD_FLAG_UNLOADED */
+struct lazy_problem_item
+{
+    struct problem_item item; /* must be the first member */
+    struct lazy_dump_dir *source;
+    char *name;
+};
+
+static struct lazy_dump_dir *lazy_dump_dir_ref(struct lazy_dump_dir *source)
+{
+    ++source->refs;
+    return source;
+}
+
+static void lazy_dump_dir_unref(struct lazy_dump_dir *source)
+{
+    if (source == NULL || --source->refs != 0)
+        return;
+
+    free(source->dir_name);
+    free(source);
+}
+
+/* Returns NULL if the directory cannot be identified, the caller must load
+ * the items immediately then. */
+static struct lazy_dump_dir *lazy_dump_dir_new(struct dump_dir *dd)
+{
+    struct stat st;
+    if (fstat(dd->dd_fd, &st) != 0)
+    {
+        log_debug("Can't stat '%s', loading all elements", dd->dd_dirname);
+        return NULL;
+    }
+
+    struct lazy_dump_dir *source = xzalloc(sizeof(*source));
+    source->refs = 1;
+    source->dir_name = xstrdup(dd->dd_dirname);
+    source->dev = st.st_dev;
+    source->ino = st.st_ino;
+    return source;
+}
+
+/* Opens the directory with a shared lock. Returns NULL and sets errno if it
+ * cannot be opened or the name points to another directory now. */
+static struct dump_dir *lazy_dump_dir_open(struct lazy_dump_dir *source)
+{
+    struct dump_dir *dd = dd_opendir(source->dir_name,
+            DD_OPEN_SHARED | DD_FAIL_QUIETLY_ENOENT | DD_FAIL_QUIETLY_EACCES);
+    if (dd == NULL)
+    {
+        if (errno == 0)
+            errno = ENOENT;
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(dd->dd_fd, &st) != 0 || st.st_dev != source->dev || st.st_ino != source->ino)
+    {
+        log_debug("'%s' has been replaced", source->dir_name);
+        dd_close(dd);
+        errno = ESTALE;
+        return NULL;
+    }
+
+    return dd;
+}
+
 static void free_problem_item(void *ptr)
 {
     if (ptr)
     {
         struct problem_item *item = (struct problem_item *)ptr;
+        if (item->flags & CD_FLAG_UNLOADED)
+        {
+            struct lazy_problem_item *lazy = (struct lazy_problem_item *)item;
+            lazy_dump_dir_unref(lazy->source);
+            free(lazy->name);
+        }
         free(item->content);
         free(item);
     }
@@ -54,6 +142,11 @@ char *problem_item_format(struct problem_item *item)
 
 int problem_item_get_size(struct problem_item *item, unsigned long *size)
 {
+    /* The content of an unloaded item is NULL */
+    const int r = problem_item_load(item);
+    if (r < 0)
+        return r;
+
     if (item->size != PROBLEM_ITEM_UNINITIALIZED_SIZE)
     {
         *size = item->size;
@@ -136,7 +229,9 @@ void problem_data_add_basics(problem_data_t *pd)
             {
                 const char *key = l->data;
                 l = l->next;
-                struct problem_item *item = g_hash_table_lookup(pd, key);
+                struct problem_item *item = problem_data_get_item_or_NULL(pd, key);
+                if (item == NULL)
+                    continue;
                 /* do not hash items which are binary (item->flags & CD_FLAG_BIN).
                  * Their ->content is full file name, with path. Path is always
                  * different and will make hash differ even if files are the same.
@@ -243,6 +338,15 @@ void problem_data_add_file(problem_data_t *pd, const char *name, const char *pat
 }
 
 
+struct problem_item *problem_data_get_item_or_NULL(problem_data_t *problem_data, const char *key)
+{
+    struct problem_item *item = (struct problem_item *)g_hash_table_lookup(problem_data, key);
+    if (item == NULL || problem_item_load(item) != 0)
+        return NULL;
+
+    return item;
+}
+
 char *problem_data_get_content_or_die(problem_data_t *problem_data, const char *key)
 {
     INITIALIZE_LIBREPORT();
@@ -317,6 +421,70 @@ static const char *const always_text_files[] = {
     FILENAME_OS_RELEASE,
     NULL
 };
+/* Adds the number of suspicious bytes in buf to *bad_chars: DEL chars and
+ * non-ASCII bytes which break the shape of UTF-8 sequences. Returns false if
+ * buf contains a control char other than white-space, which makes it binary.
+ */
+static bool count_bad_text_chars(const unsigned char *buf, size_t size, unsigned *bad_chars)
+{
+    size_t i = 0;
+    /* Whether the byte before buf[i] was non-ASCII */
+    unsigned prev_was_unicode = 0;
+#ifdef __SSE2__
+    const __m128i last_control = _mm_set1_epi8(' ' - 1);
+    const __m128i first_space = _mm_set1_epi8('\t');
+    const __m128i space_range = _mm_set1_epi8('\r' - '\t');
+    const __m128i del = _mm_set1_epi8(0x7f);
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(buf + i));
+
+        /* Among control chars, only '\t','\n' etc are allowed */
+        const __m128i control = _mm_cmpeq_epi8(_mm_min_epu8(v, last_control), v);
+        const __m128i shifted = _mm_sub_epi8(v, first_space);
+        const __m128i space = _mm_cmpeq_epi8(_mm_min_epu8(shifted, space_range), shifted);
+        if (_mm_movemask_epi8(_mm_andnot_si128(space, control)) != 0)
+            return false;
+
+        /* Bit n is set if byte n is > 0x7f */
+        const unsigned unicode = _mm_movemask_epi8(v);
+        /* Bit n is set if byte n is 11xxxxxx or x1xxxxxx */
+        const unsigned bit6 = _mm_movemask_epi8(_mm_slli_epi16(v, 1));
+        const unsigned prev = ((unicode << 1) | prev_was_unicode) & 0xffff;
+
+        /* See the scalar loop below */
+        const unsigned bad_unicode = unicode & ~(prev ^ bit6);
+        const unsigned bad_del = _mm_movemask_epi8(_mm_cmpeq_epi8(v, del));
+
+        *bad_chars += __builtin_popcount(bad_unicode) + __builtin_popcount(bad_del);
+        prev_was_unicode = unicode >> 15;
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        /* Among control chars, only '\t','\n' etc are allowed */
+        if (buf[i] < ' ' && !isspace(buf[i]))
+            return false;
+
+        if (buf[i] == 0x7f)
+            ++*bad_chars;
+        else if (buf[i] > 0x7f)
+        {
+            /* We test two possible bad cases with one comparison:
+             * (1) prev byte was unicode AND cur byte is 11xxxxxx:
+             * BAD - unicode start byte can't be in the middle of unicode char
+             * (2) prev byte wasnt unicode AND cur byte is 10xxxxxx:
+             * BAD - unicode continuation byte can't start unicode char
+             */
+            if (prev_was_unicode == ((buf[i] & 0x40) == 0x40))
+                ++*bad_chars;
+        }
+        prev_was_unicode = (buf[i] > 0x7f);
+    }
+
+    return true;
+}
+
 static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t *sz, int *file_fd)
 {
     /* We were using magic.h API to check for file being text, but it thinks
@@ -378,33 +546,13 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
     const unsigned RATIO = 10;
     unsigned total_chars = r + RATIO;
     unsigned bad_chars = 1; /* 1 prevents division by 0 later */
-    bool prev_was_unicode = 0;
-    ssize_t i = -1;
-    while (++i < r)
+    if (!count_bad_text_chars(buf, r, &bad_chars))
     {
-        /* Among control chars, only '\t','\n' etc are allowed */
-        if (buf[i] < ' ' && !isspace(buf[i]))
-        {
-            /* We don't like NULs and other control chars very much.
-             * Not text for sure!
-             */
-            free(buf);
-            return CD_FLAG_BIN;
-        }
-        if (buf[i] == 0x7f)
-            bad_chars++;
-        else if (buf[i] > 0x7f)
-        {
-            /* We test two possible bad cases with one comparison:
-             * (1) prev byte was unicode AND cur byte is 11xxxxxx:
-             * BAD - unicode start byte can't be in the middle of unicode char
-             * (2) prev byte wasnt unicode AND cur byte is 10xxxxxx:
-             * BAD - unicode continuation byte can't start unicode char
-             */
-            if (prev_was_unicode == ((buf[i] & 0x40) == 0x40))
-                bad_chars++;
-        }
-        prev_was_unicode = (buf[i] > 0x7f);
+        /* We don't like NULs and other control chars very much.
+         * Not text for sure!
+         */
+        free(buf);
+        return CD_FLAG_BIN;
     }
 
     if ((total_chars / bad_chars) >= RATIO)
@@ -425,7 +573,7 @@ static int is_text_file_at(int dir_fd, const char *name, char **content, ssize_t
 }
 
 
-static int _problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, char **content, int *type_flags, int *fd)
+static int _problem_data_load_dump_dir_element(int dir_fd, const char *name, char **content, int *type_flags, int *fd)
 {
     int file_fd = -1;
     int *file_fd_ptr = fd == NULL ? &file_fd : fd;
@@ -434,7 +582,7 @@ static int _problem_data_load_dump_dir_element(struct dump_dir *dd, const char *
 
     ssize_t sz = IS_TEXT_FILE_AT_PROBE_SIZE;
     char *text = NULL;
-    int r = is_text_file_at(dd->dd_fd, name, &text, &sz, file_fd_ptr);
+    int r = is_text_file_at(dir_fd, name, &text, &sz, file_fd_ptr);
 
     if (r < 0)
         return r;
@@ -491,14 +639,113 @@ int problem_data_load_dump_dir_element(struct dump_dir *dd, const char *name, ch
     if (!str_is_correct_filename(name))
         return -EINVAL;
 
-    return _problem_data_load_dump_dir_element(dd, name, content, type_flags, fd);
+    return _problem_data_load_dump_dir_element(dd->dd_fd, name, content, type_flags, fd);
 }
 
-void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding)
+/* Loads the element and sets the flags problem_data_load_from_dump_dir()
+ * adds the elements with. Binary elements get their path as content.
+ */
+static int load_dump_dir_element_with_flags(int dir_fd, const char *dir_name,
+        const char *name, char **content, int *flags)
+{
+    int r = _problem_data_load_dump_dir_element(dir_fd, name, content, flags, /*fd*/NULL);
+    if (r < 0)
+        return r;
+
+    if (*flags & CD_FLAG_TXT)
+    {
+        if (is_editable_file(name))
+            *flags |= CD_FLAG_ISEDITABLE;
+        else
+            *flags |= CD_FLAG_ISNOTEDITABLE;
+
+        static const char *const list_files[] = {
+            FILENAME_UID       ,
+            FILENAME_PACKAGE   ,
+            FILENAME_CMDLINE   ,
+            FILENAME_TIME      ,
+            FILENAME_COUNT     ,
+            FILENAME_REASON    ,
+            NULL
+        };
+        if (is_in_string_list(name, list_files))
+            *flags |= CD_FLAG_LIST;
+
+        if (strcmp(name, FILENAME_TIME) == 0)
+            *flags |= CD_FLAG_UNIXTIME;
+    }
+    else
+        *content = concat_path_file(dir_name, name);
+
+    return 0;
+}
+
+int problem_item_load(struct problem_item *item)
+{
+    if (!(item->flags & CD_FLAG_UNLOADED))
+        return 0;
+
+    struct lazy_problem_item *lazy = (struct lazy_problem_item *)item;
+    /* Failed already, do not complain again */
+    if (lazy->source == NULL)
+        return -ENOENT;
+
+    char *content = NULL;
+    int flags = 0;
+    int r;
+    struct dump_dir *dd = lazy_dump_dir_open(lazy->source);
+    if (dd == NULL)
+        r = -errno;
+    else
+    {
+        r = load_dump_dir_element_with_flags(dd->dd_fd, dd->dd_dirname, lazy->name, &content, &flags);
+        dd_close(dd);
+    }
+
+    lazy_dump_dir_unref(lazy->source);
+    lazy->source = NULL;
+
+    if (r < 0)
+    {
+        error_msg("Failed to load element %s: %s", lazy->name, strerror(-r));
+        return r;
+    }
+
+    free(lazy->name);
+    lazy->name = NULL;
+
+    /* Same as problem_data_add() */
+    if (!(flags & CD_FLAG_BIN))
+        flags |= CD_FLAG_TXT;
+    if (!(flags & CD_FLAG_ISEDITABLE))
+        flags |= CD_FLAG_ISNOTEDITABLE;
+
+    item->content = content;
+    item->flags = flags;
+    return 0;
+}
+
+static void problem_data_add_lazy(problem_data_t *problem_data, const char *name,
+        struct lazy_dump_dir *source)
+{
+    struct lazy_problem_item *lazy = (struct lazy_problem_item *)xzalloc(sizeof(*lazy));
+    lazy->item.flags = CD_FLAG_UNLOADED;
+    lazy->item.size = PROBLEM_ITEM_UNINITIALIZED_SIZE;
+    lazy->source = lazy_dump_dir_ref(source);
+    lazy->name = xstrdup(name);
+    g_hash_table_replace(problem_data, xstrdup(name), lazy);
+}
+
+void problem_data_load_from_dump_dir_ext(problem_data_t *problem_data, struct dump_dir *dd,
+        char **excluding, int flags)
 {
     char *short_name;
     char *full_name;
 
+    struct lazy_dump_dir *source = NULL;
+    if (flags & PROBLEM_DATA_LOAD_LAZILY)
+        source = lazy_dump_dir_new(dd);
+
     dd_init_next_file(dd);
     while (dd_get_next_file(dd, &short_name, &full_name))
     {
@@ -515,53 +762,52 @@ void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_d
             goto next;
         }
 
-        char *content = NULL;
-        int flags = 0;
-        int r = _problem_data_load_dump_dir_element(dd, short_name, &content, &flags, /*fd*/NULL);
-        if (r < 0)
+        if (source != NULL)
         {
-            error_msg("Failed to load element %s: %s", short_name, strerror(-r));
+            /* Don't register the elements secure_openat_read() rejects */
+            struct stat st;
+            int err = 0;
+            if (fstatat(dd->dd_fd, short_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+                err = errno;
+            else if (!S_ISREG(st.st_mode) || st.st_nlink > 1)
+                err = EINVAL;
+
+            if (err != 0)
+            {
+                error_msg("Failed to load element %s: %s", short_name, strerror(err));
+                goto next;
+            }
+
+            problem_data_add_lazy(problem_data, short_name, source);
             goto next;
         }
 
-        if (flags & CD_FLAG_TXT)
-        {
-            if (is_editable_file(short_name))
-                flags |= CD_FLAG_ISEDITABLE;
-            else
-                flags |= CD_FLAG_ISNOTEDITABLE;
-
-            static const char *const list_files[] = {
-                FILENAME_UID       ,
-                FILENAME_PACKAGE   ,
-                FILENAME_CMDLINE   ,
-                FILENAME_TIME      ,
-                FILENAME_COUNT     ,
-                FILENAME_REASON    ,
-                NULL
-            };
-            if (is_in_string_list(short_name, list_files))
-                flags |= CD_FLAG_LIST;
-
-            if (strcmp(short_name, FILENAME_TIME) == 0)
-                flags |= CD_FLAG_UNIXTIME;
-        }
-        else
+        char *content = NULL;
+        int item_flags = 0;
+        int r = load_dump_dir_element_with_flags(dd->dd_fd, dd->dd_dirname, short_name, &content, &item_flags);
+        if (r < 0)
         {
-            content = full_name;
-            full_name = NULL;
+            error_msg("Failed to load element %s: %s", short_name, strerror(-r));
+            goto next;
         }
 
         problem_data_add(problem_data,
                 short_name,
                 content,
-                flags
+                item_flags
         );
         free(content);
  next:
         free(short_name);
         free(full_name);
     }
+
+    lazy_dump_dir_unref(source);
+}
+
+void problem_data_load_from_dump_dir(problem_data_t *problem_data, struct dump_dir *dd, char **excluding)
+{
+    problem_data_load_from_dump_dir_ext(problem_data, dd, excluding, /*flags*/0);
 }
 
 problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd)
@@ -572,13 +818,18 @@ problem_data_t *create_problem_data_from_dump_dir(struct dump_dir *dd)
 }
 
 problem_data_t *create_problem_data_for_reporting(const char *dump_dir_name)
+{
+    return create_problem_data_for_reporting_ext(dump_dir_name, /*flags*/0);
+}
+
+problem_data_t *create_problem_data_for_reporting_ext(const char *dump_dir_name, int flags)
 {
     struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
     if (!dd)
         return NULL; /* dd_opendir already emitted error msg */
     string_vector_ptr_t exclude_items = get_global_always_excluded_elements();
     problem_data_t *problem_data = problem_data_new();
-    problem_data_load_from_dump_dir(problem_data, dd, exclude_items);
+    problem_data_load_from_dump_dir_ext(problem_data, dd, exclude_items, flags);
     dd_close(dd);
     string_vector_free(exclude_items);
     return problem_data;
@@ -592,6 +843,9 @@ void log_problem_data(problem_data_t *problem_data, const char *pfx)
     g_hash_table_iter_init(&iter, problem_data);
     while (g_hash_table_iter_next(&iter, (void**)&name, (void**)&value))
     {
+        if (problem_item_load(value) != 0)
+            continue;
+
         log_warning("%s[%s]:'%s' 0x%x",
                 pfx, name,
                 value->content,
@@ -0,0 +1,216 @@
+/*
+    Copyright (C) 2016  ABRT team
+    Copyright (C) 2016  RedHat Inc
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License along
+    with this program; if not, write to the Free Software Foundation, Inc.,
+    51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+#include <dlfcn.h>
+#include "internal_libreport.h"
+#include "reporter_plugin.h"
+
+#define REPORTER_PLUGINS_DIR PLUGINS_LIB_DIR"/reporters"
+
+/* The plugins are never unloaded */
+static GList *s_reporter_plugins;
+static bool s_reporter_plugins_loaded;
+
+static void load_reporter_plugin(const char *path)
+{
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+    {
+        log_warning("Can't load reporter plugin '%s': %s", path, dlerror());
+        return;
+    }
+
+    const struct reporter_plugin *plugin = dlsym(handle, REPORTER_PLUGIN_SYMBOL);
+    if (!plugin)
+    {
+        log_warning("'%s' is not a reporter plugin", path);
+        goto fail;
+    }
+
+    if (plugin->abi_version != REPORTER_PLUGIN_ABI_VERSION || !plugin->name || !plugin->report)
+    {
+        log_warning("Reporter plugin '%s' has unsupported ABI version %u", path, plugin->abi_version);
+        goto fail;
+    }
+
+    log_info("Loaded reporter plugin '%s' from '%s'", plugin->name, path);
+    s_reporter_plugins = g_list_prepend(s_reporter_plugins, (gpointer)plugin);
+    return;
+
+ fail:
+    dlclose(handle);
+}
+
+static void load_reporter_plugins(void)
+{
+    if (s_reporter_plugins_loaded)
+        return;
+    s_reporter_plugins_loaded = true;
+
+    /* Don't let the environment load code into setuid programs */
+    const char *dir_name = secure_getenv("LIBREPORT_REPORTER_PLUGINS_DIR");
+    if (!dir_name)
+        dir_name = REPORTER_PLUGINS_DIR;
+    if (dir_name[0] == '\0')
+        return;
+
+    DIR *dir = opendir(dir_name);
+    if (!dir)
+    {
+        if (errno != ENOENT)
+            perror_msg("Can't open directory '%s'", dir_name);
+        return;
+    }
+
+    struct dirent *dent;
+    while ((dent = readdir(dir)) != NULL)
+    {
+        if (suffixcmp(dent->d_name, ".so") != 0)
+            continue;
+
+        char *path = concat_path_file(dir_name, dent->d_name);
+        load_reporter_plugin(path);
+        free(path);
+    }
+
+    closedir(dir);
+}
+
+/* Returns the first executable named 'name' in $PATH as execvp() finds it */
+static char *find_program_in_path(const char *name)
+{
+    const char *path = getenv("PATH");
+    if (!path)
+        path = "/bin:/usr/bin";
+
+    while (1)
+    {
+        const char *end = strchrnul(path, ':');
+        /* An empty entry means the current directory */
+        char *dir = end > path ? xstrndup(path, end - path) : xstrdup(".");
+        char *file = concat_path_file(dir, name);
+        free(dir);
+
+        struct stat st;
+        if (stat(file, &st) == 0 && S_ISREG(st.st_mode) && access(file, X_OK) == 0)
+            return file;
+        free(file);
+
+        if (*end == '\0')
+            return NULL;
+        path = end + 1;
+    }
+}
+
+/* The plugin replaces the installed program only, not a program of the same
+ * name somewhere else, e.g. a local wrapper */
+static bool is_installed_program(const char *program, const char *name)
+{
+    /* Don't let the environment replace programs in setuid programs */
+    const char *bin_dir = secure_getenv("LIBREPORT_REPORTER_PROGRAMS_DIR");
+    if (!bin_dir)
+        bin_dir = BIN_DIR;
+
+    char *installed = concat_path_file(bin_dir, name);
+    struct stat installed_st;
+    const int r = stat(installed, &installed_st);
+    free(installed);
+    if (r != 0)
+        return false;
+
+    char *found = NULL;
+    if (program == name)
+    {
+        found = find_program_in_path(name);
+        if (!found)
+            return false;
+        program = found;
+    }
+    /* The command runs in the dump directory, a relative path is not ours */
+    else if (program[0] != '/')
+        return false;
+
+    struct stat st;
+    const bool installed_program = stat(program, &st) == 0
+                                && st.st_dev == installed_st.st_dev
+                                && st.st_ino == installed_st.st_ino;
+    free(found);
+    return installed_program;
+}
+
+const struct reporter_plugin *find_reporter_plugin(const char *program)
+{
+    load_reporter_plugins();
+
+    const char *name = strrchr(program, '/');
+    name = name ? name + 1 : program;
+
+    for (GList *iter = s_reporter_plugins; iter; iter = g_list_next(iter))
+    {
+        const struct reporter_plugin *plugin = iter->data;
+        if (strcmp(plugin->name, name) == 0)
+            return is_installed_program(program, name) ? plugin : NULL;
+    }
+
+    return NULL;
+}
+
+/* Adds the options of the event and of the events it imports */
+static void add_event_settings(map_string_t *settings, const char *event)
+{
+    event_config_t *config = get_event_config(event);
+    if (!config)
+        return;
+
+    for (GList *iter = config->ec_imported_event_names; iter; iter = g_list_next(iter))
+        add_event_settings(settings, iter->data);
+
+    for (GList *iter = config->options; iter; iter = g_list_next(iter))
+    {
+        event_option_t *opt = iter->data;
+        /* The environment overrides the configuration, see export_event_config() */
+        const char *value = getenv(opt->eo_name);
+        if (!value)
+            value = opt->eo_value;
+        if (value)
+            replace_map_string_item(settings, xstrdup(opt->eo_name), xstrdup(value));
+    }
+}
+
+int run_reporter_plugin(const struct reporter_plugin *plugin,
+                        char **argv,
+                        problem_data_t *problem_data,
+                        const char *event,
+                        struct run_event_state *state)
+{
+    int argc = 0;
+    while (argv[argc])
+        argc++;
+
+    map_string_t *settings = new_map_string();
+    add_event_settings(settings, event);
+
+    /* The plugins parse argv by getopt, start from the beginning */
+    optind = 0;
+
+    log_info("Running reporter plugin '%s'", plugin->name);
+    const int r = plugin->report(argc, argv, problem_data, settings, state);
+
+    free_map_string(settings);
+    return r;
+}
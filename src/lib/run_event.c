@@ -17,12 +17,19 @@
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 #include <glob.h>
+#include <poll.h>
 #include <regex.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
 #include "client.h"
 #include "internal_libreport.h"
+#include "reporter_plugin.h"
 
 static char *run_event_stdio_log(char *log_line, void *param);
 static void run_event_stdio_error_and_die(const char *error_line, void *param);
+static void free_command_stats(struct run_event_command_stats *stats);
+static void write_command_stats(struct run_event_state *state);
 
 struct run_event_state *new_run_event_state()
 {
@@ -40,6 +47,11 @@ struct run_event_state *new_run_event_state()
 
     state->command_output = strbuf_new();
 
+    const long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    state->max_concurrent_commands = cpus > 1 ? cpus : 1;
+
+    state->log_command_stats = getenv("LIBREPORT_EVENT_STATS") != NULL;
+
     return state;
 }
 
@@ -49,6 +61,8 @@ void free_run_event_state(struct run_event_state *state)
     {
         strbuf_free(state->command_output);
         free_commands(state);
+        strbuf_free(state->command_stats_lines);
+        free_command_stats(&state->command_stats);
         free(state);
     }
 }
@@ -117,14 +131,31 @@ void make_run_event_state_forwarding(struct run_event_state *state)
  * does not expose the way we select rules to execute.
  */
 
+static void free_rule(struct rule *rule)
+{
+    for (unsigned i = 0; i < rule->cond_count; ++i)
+    {
+        free(rule->cond_vec[i].name);
+        free(rule->cond_vec[i].value);
+        if (rule->cond_vec[i].regex)
+        {
+            regfree(rule->cond_vec[i].regex);
+            free(rule->cond_vec[i].regex);
+        }
+    }
+    free(rule->cond_vec);
+    list_free_with_free(rule->conditions);
+    list_free_with_free(rule->after);
+    free(rule->id);
+    free(rule->command);
+    free(rule);
+}
+
 void free_rule_list(GList *rule_list)
 {
     while (rule_list)
     {
-        struct rule *cur_rule = rule_list->data;
-        list_free_with_free(cur_rule->conditions);
-        free(cur_rule->command);
-        free(cur_rule);
+        free_rule(rule_list->data);
 
         GList *next = rule_list->next;
         g_list_free_1(rule_list);
@@ -132,20 +163,145 @@ void free_rule_list(GList *rule_list)
     }
 }
 
+/* Splits the "VAR=VAL", "VAR!=VAL" and "VAR~=REGEX" words of the rule into
+ * triples, so matching doesn't need to parse them again for every event.
+ */
+static void parse_rule_conditions(struct rule *rule)
+{
+    rule->cond_vec = xzalloc(sizeof(rule->cond_vec[0]) * g_list_length(rule->conditions));
+
+    for (GList *c = rule->conditions; c != NULL; c = g_list_next(c))
+    {
+        const char *cond_str = c->data;
+        const char *eq_sign = strchr(cond_str, '=');
+        struct rule_condition *cond = &rule->cond_vec[rule->cond_count++];
+
+        cond->op = RULE_COND_EQ;
+        if (eq_sign > cond_str && eq_sign[-1] == '~')
+            cond->op = RULE_COND_REGEX;
+        else if (eq_sign > cond_str && eq_sign[-1] == '!')
+            cond->op = RULE_COND_NE;
+
+        cond->name = xstrndup(cond_str, eq_sign - cond_str - (cond->op != RULE_COND_EQ));
+        cond->value = xstrdup(eq_sign + 1);
+
+        /* Is it "ID=name" or "AFTER=name1,name2"? They are not conditions,
+         * they tell which commands can run concurrently.
+         */
+        if (cond->op == RULE_COND_EQ
+            && (strcmp(cond->name, "ID") == 0 || strcmp(cond->name, "AFTER") == 0))
+        {
+            rule->annotated = true;
+            if (strcmp(cond->name, "ID") == 0)
+            {
+                free(rule->id);
+                rule->id = cond->value;
+            }
+            else
+            {
+                rule->after = g_list_concat(rule->after, parse_delimited_list(cond->value, ","));
+                free(cond->value);
+            }
+            free(cond->name);
+            memset(cond, 0, sizeof(*cond));
+            rule->cond_count--;
+        }
+        /* Is it "EVENT=foo"? */
+        else if (cond->op == RULE_COND_EQ && strcmp(cond->name, "EVENT") == 0)
+        {
+            cond->op = RULE_COND_EVENT;
+            if (rule->event == NULL)
+                rule->event = cond->value;
+        }
+        else if (cond->op == RULE_COND_REGEX)
+        {
+            /* Compile it once here and not for every event and dump dir.
+             * REG_NEWLINE makes '^' and '$' match at line boundaries and
+             * stops '.' at newlines, so a match is a match of some line.
+             */
+            cond->regex = xmalloc(sizeof(*cond->regex));
+            int r = regcomp(cond->regex, cond->value, REG_EXTENDED | REG_NOSUB | REG_NEWLINE);
+            if (r)
+            {
+                char errbuf[256];
+                regerror(r, cond->regex, errbuf, sizeof(errbuf));
+                error_msg("Bad regexp '%s': %s", cond->value, errbuf);
+                free(cond->regex);
+                cond->regex = NULL;
+            }
+        }
+    }
+}
+
 /* Stop-gap measure against infinite recursion */
 #define MAX_recursion_depth 32
 
-GList *load_rule_list(GList *rule_list,
+/* Files and directories the rules were loaded from */
+struct rule_file_deps
+{
+    GPtrArray *files; /* struct rule_file_dep */
+    /* The rules depend on files which can't be tracked */
+    bool untrackable;
+};
+
+struct rule_file_dep
+{
+    char *path;
+    bool exists;
+    struct stat st;
+};
+
+static void rule_file_deps_add(struct rule_file_deps *deps, const char *path, const struct stat *st)
+{
+    struct rule_file_dep *dep = xzalloc(sizeof(*dep));
+    dep->path = xstrdup(path);
+    if (st)
+    {
+        dep->exists = true;
+        dep->st = *st;
+    }
+    g_ptr_array_add(deps->files, dep);
+}
+
+/* The files matching an include can change only if an entry is added to
+ * or removed from the directory of the glob pattern.
+ */
+static void rule_file_deps_add_glob(struct rule_file_deps *deps, const char *pattern)
+{
+    char *dir_name = g_path_get_dirname(pattern);
+    if (strpbrk(dir_name, "*?[") != NULL)
+        deps->untrackable = true;
+    else
+    {
+        struct stat st;
+        rule_file_deps_add(deps, dir_name, stat(dir_name, &st) == 0 ? &st : NULL);
+    }
+    g_free(dir_name);
+}
+
+static GList *load_rule_file(GList *rule_list,
                 const char *conf_file_name,
-                unsigned recursion_depth
+                unsigned recursion_depth,
+                struct rule_file_deps *deps
 ) {
     FILE *conffile = fopen(conf_file_name, "r");
     if (!conffile)
     {
         error_msg("Can't open '%s'", conf_file_name);
+        if (deps)
+            rule_file_deps_add(deps, conf_file_name, NULL);
         return rule_list;
     }
 
+    if (deps)
+    {
+        struct stat st;
+        if (fstat(fileno(conffile), &st) == 0)
+            rule_file_deps_add(deps, conf_file_name, &st);
+        else
+            deps->untrackable = true;
+    }
+
     /* Used only for better warning message */
     int line_counter = 0;
     /* Read and remember rules */
@@ -256,6 +412,7 @@ GList *load_rule_list(GList *rule_list,
             }
 
             cur_rule->command = xstrdup(p);
+            parse_rule_conditions(cur_rule);
 
             rule_list = g_list_append(rule_list, cur_rule);
         }
@@ -287,12 +444,14 @@ GList *load_rule_list(GList *rule_list,
             memset(&globbuf, 0, sizeof(globbuf));
             log_parser("globbing '%s'", name_to_glob);
             glob(name_to_glob, 0, NULL, &globbuf);
+            if (deps)
+                rule_file_deps_add_glob(deps, name_to_glob);
             free(name_to_glob);
             char **name = globbuf.gl_pathv;
             if (name) while (*name)
             {
                 log_parser("recursing into '%s'", *name);
-                rule_list = load_rule_list(rule_list, *name, recursion_depth + 1);
+                rule_list = load_rule_file(rule_list, *name, recursion_depth + 1, deps);
                 log_parser("returned from '%s'", *name);
                 name++;
             }
@@ -309,394 +468,1507 @@ GList *load_rule_list(GList *rule_list,
     return rule_list;
 }
 
-static int regcmp_lines(char *val, const char *regex)
-{
-    regex_t rx;
-    int r = regcomp(&rx, regex, REG_NOSUB); //TODO: and REG_EXTENDED?
-    //log_warning("REGEX:'%s':%d", regex, r);
-    if (r)
-    {
-        //char errbuf[256];
-        //size_t needsz = regerror(r, &rx, errbuf, sizeof(errbuf));
-        error_msg("Bad regexp '%s'", regex); // TODO: use errbuf?
-        return r;
-    }
-
-    /* Check every line */
-    while (1)
-    {
-        char *eol = strchr(val, '\n');
-        if (eol)
-            *eol = '\0';
-        r = regexec(&rx, val, 0, NULL, /*eflags:*/ 0);
-        //log_warning("REGCMP:'%s':%d", val, r);
-        if (eol)
-            *eol = '\n';
-        if (r == 0 || !eol)
-            break;
-        val = eol + 1;
-    }
-    /* Here, r == 0 if match was found */
-    regfree(&rx);
-    return r;
+GList *load_rule_list(GList *rule_list,
+                const char *conf_file_name,
+                unsigned recursion_depth
+) {
+    return load_rule_file(rule_list, conf_file_name, recursion_depth, /*deps:*/ NULL);
 }
 
-/* Checks rules in *pp_rule_list, starting from first (remaining) rule,
- * until it finds a rule with all conditions satisfied.
- * In this case, it deletes this rule and returns this rule's cmd.
- * Else (if it didn't find such rule), it returns NULL.
- * In case of error (dump_dir can't be opened), returns NULL.
+/* Persistent cache of parsed rules
  *
- * Intended usage:
- * list = load_rule_list(...);
- * while ((cmd = pop_next_command(&list, ...)) != NULL)
- *     run(cmd);
+ * Every process handling an event parses report_event.conf and all files
+ * it includes. The parsed rules are therefore stored in
+ * $XDG_CACHE_HOME/libreport/rules/ together with the identification
+ * (device, inode, size and mtime) of every file and include directory
+ * they were loaded from. The cache is used only if none of them changed.
+ *
+ * The layout of the cache file (native byte order):
+ *   struct rule_cache_header
+ *   struct rule_cache_dep[dep_count]
+ *   uint32_t words[word_count] - for each rule: number of conditions,
+ *                                offset of command, offsets of conditions
+ *   char strings[strings_size] - NUL terminated strings
  */
-static char* pop_next_command(GList **pp_rule_list,
-        char **pp_event_name,    /* reports EVENT value thru this, if not NULL on entry */
-        struct dump_dir **pp_dd, /* use *pp_dd for access to dump dir, if non-NULL */
-        problem_data_t *pd,      /* use *pd for access to problem data, if non-NULL */
-        const char *dump_dir_name,
-        const char *pfx,
-        unsigned pfx_len
-)
-{
-    /* It is an error to pass both, but we can recover from it and use only
-     * problem_data_t in that case */
-    if (pp_dd != NULL && pd != NULL)
-        error_msg("BUG: both dump dir and problem data passed to %s()", __func__);
-
-    char *command = NULL;
-    struct dump_dir *dd = pp_dd ? *pp_dd : NULL;
-
-    GList *rule_list = *pp_rule_list;
-    while (rule_list)
-    {
-        struct rule *cur_rule = rule_list->data;
+#define RULE_CACHE_MAGIC "LRRULES1"
 
-        GList *condition = cur_rule->conditions;
-        while (condition)
-        {
-            const char *cond_str = condition->data;
-            const char *eq_sign = strchr(cond_str, '=');
+struct rule_cache_header
+{
+    char magic[8];
+    uint32_t dep_count;
+    uint32_t rule_count;
+    uint32_t word_count;
+    uint32_t strings_size;
+};
+
+struct rule_cache_dep
+{
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint32_t path;   /* offset in strings */
+    uint32_t exists;
+};
+
+static char *rule_cache_file_name(const char *conf_file_name)
+{
+    char *name = xasprintf("%s.cache", conf_file_name);
+    for (char *c = name; *c; ++c)
+        if (*c == '/')
+            *c = '_';
 
-            /* Is it "EVENT=foo"? */
-            if (strncmp(cond_str, "EVENT=", 6) == 0)
-            {
-                if (strncmp(eq_sign + 1, pfx, pfx_len) != 0)
-                    goto next_rule; /* prefix doesn't match */
-                if (pp_event_name)
-                {
-                    free(*pp_event_name);
-                    *pp_event_name = xstrdup(eq_sign + 1);
-                }
-            }
-            else
-            {
-                /* Read from dump dir and compare */
-                if (!dd && pd == NULL)
-                {
-                    /* Without dir to match, we assume match for all conditions */
-                    if (!dump_dir_name)
-                        goto next_cond;
-                    dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_READONLY);
-                    if (!dd)
-                    {
-                        free_rule_list(rule_list);
-                        *pp_rule_list = NULL;
-                        goto ret; /* error (note: dd_opendir logged error msg) */
-                    }
-                }
-                /* Is it "VAR~=REGEX"? */
-                int regex = (eq_sign > cond_str && eq_sign[-1] == '~');
-                /* Is it "VAR!=VAL"? */
-                int inverted = (eq_sign > cond_str && eq_sign[-1] == '!');
-                char *var_name = xstrndup(cond_str, eq_sign - cond_str - (regex|inverted));
-                char *real_val = NULL;
-                char *free_me = NULL;
-                if (pd == NULL)
-                    free_me = real_val = dd_load_text_ext(dd, var_name, DD_FAIL_QUIETLY_ENOENT);
-                else
-                    real_val = problem_data_get_content_or_NULL(pd, var_name);
-                free(var_name);
-                int vals_differ = regex ? regcmp_lines(real_val, eq_sign + 1) : strcmp(real_val, eq_sign + 1);
-                free(free_me);
-                if (inverted)
-                    vals_differ = !vals_differ;
-
-                /* Do values match? */
-                if (vals_differ) /* no */
-                {
-                    goto next_rule;
-                }
-            }
- next_cond:
-            /* We are here if current condition is satisfied */
-
-            condition = condition->next;
-        } /* while (condition) */
-        /* We are here if all conditions are satisfied */
-        /* IOW, we found rule to run, delete it and return its command */
-        *pp_rule_list = g_list_remove(*pp_rule_list, cur_rule);
-        list_free_with_free(cur_rule->conditions);
-        command = cur_rule->command;
-        /*free(cur_rule->command); - WRONG! we are returning it! */
-        free(cur_rule);
-        break;
-
- next_rule:
-        rule_list = rule_list->next;
-    } /* while (rule_list) */
+    char *cache_dir = concat_path_file(g_get_user_cache_dir(), "libreport/rules");
+    char *cache_name = concat_path_file(cache_dir, name);
+    free(cache_dir);
+    free(name);
 
- ret:
-    if (pp_dd)
-        *pp_dd = dd;
-    else
-        dd_close(dd);
-    return command;
+    return cache_name;
 }
 
-void free_commands(struct run_event_state *state)
+static bool rule_cache_dep_is_current(const struct rule_cache_dep *dep, const char *path)
 {
-    free_rule_list(state->rule_list);
-    state->rule_list = NULL;
-    state->command_out_fd = -1;
-    state->command_pid = 0;
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return !dep->exists;
+
+    return dep->exists
+        && dep->dev == (uint64_t)st.st_dev
+        && dep->ino == (uint64_t)st.st_ino
+        && dep->size == (uint64_t)st.st_size
+        && dep->mtime_sec == (int64_t)st.st_mtim.tv_sec
+        && dep->mtime_nsec == (int64_t)st.st_mtim.tv_nsec;
 }
 
-int prepare_commands(struct run_event_state *state,
-                const char *dump_dir_name,
-                const char *event
-) {
-    free_commands(state);
-
-    state->children_count = 0;
-    strbuf_clear(state->command_output);
-
-    GList *rule_list = load_rule_list(NULL, CONF_DIR"/report_event.conf", /*recursion_depth:*/ 0);
-    state->rule_list = rule_list;
-    return rule_list != NULL;
+/* The rules decide which commands are executed. A privileged process must
+ * not use a cache found through an environment it may have inherited from
+ * an unprivileged user ($XDG_CACHE_HOME).
+ */
+static bool rule_cache_is_allowed(void)
+{
+    const uid_t euid = geteuid();
+    return euid != 0 && euid == getuid() && getegid() == getgid();
 }
 
-int spawn_next_command(struct run_event_state *state,
-                const char *dump_dir_name,
-                const char *event,
-                unsigned execflags
-) {
-    char *cmd = pop_next_command(&state->rule_list,
-                NULL,          /* don't return event_name */
-                NULL,          /* NULL dd: we match by... */
-                NULL,          /* no problem data */
-                dump_dir_name, /* ...dirname */
-                event, strlen(event)+1 /* for this event name exactly (not prefix) */
-    );
-    if (!cmd)
-        return -1;
-
-    /* We count it even if fork fails. The counter isn't meant
-     * to count *successful* forks, it is meant to let caller know
-     * whether the event we run has *any* handlers configured, or not.
-     */
-    state->children_count++;
+/* Returns false if the cache doesn't exist, is corrupted, out of date or
+ * could have been written by someone else
+ */
+static bool rule_cache_load(const char *cache_name, const char *conf_file_name, GList **rule_list)
+{
+    int fd = open(cache_name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return false;
 
-    log_info("Next command: '%s'", cmd);
+    bool retval = false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct rule_cache_header))
+        goto close_fd;
 
-    /* Export some useful environment variables for children */
-    char *env_vec[4];
-    /* Just exporting dump_dir_name isn't always ok: it can be "."
-     * and some children want to cd to other directory but still
-     * be able to find problem directory by using $DUMP_DIR...
-     */
-    char *full_name = realpath(dump_dir_name, NULL);
-    env_vec[0] = xasprintf("DUMP_DIR=%s", (full_name ? full_name : dump_dir_name));
-    free(full_name);
-    env_vec[1] = xasprintf("EVENT=%s", event);
-    env_vec[2] = xasprintf("REPORT_CLIENT_SLAVE=1");
-    env_vec[3] = NULL;
+    if (!S_ISREG(st.st_mode) || st.st_uid != geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)))
+    {
+        log_info("Rule cache '%s' is not owned by the user or is writable by others", cache_name);
+        goto close_fd;
+    }
 
-    char *argv[4];
-    argv[0] = (char*)"/bin/sh"; // TODO: honor $SHELL?
-    argv[1] = (char*)"-c";
-    argv[2] = cmd;
-    argv[3] = NULL;
+    const size_t size = st.st_size;
+    const char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        goto close_fd;
+
+    const struct rule_cache_header *header = (const void *)data;
+    if (memcmp(header->magic, RULE_CACHE_MAGIC, sizeof(header->magic)) != 0
+     || size != sizeof(*header)
+                + (uint64_t)header->dep_count * sizeof(struct rule_cache_dep)
+                + (uint64_t)header->word_count * sizeof(uint32_t)
+                + header->strings_size
+     || header->strings_size == 0)
+    {
+        log_info("Rule cache '%s' is corrupted", cache_name);
+        goto unmap;
+    }
 
-    int pipefds[2];
-    state->command_pid = fork_execv_on_steroids(
-                EXECFLG_INPUT | EXECFLG_OUTPUT | EXECFLG_ERR2OUT | execflags,
-                argv,
-                pipefds,
-                /* env_vec: */ env_vec,
-                /* dir: */ dump_dir_name,
-                /* uid(unused): */ 0
-    );
-    state->command_out_fd = pipefds[0];
-    state->command_in_fd = pipefds[1];
+    const struct rule_cache_dep *deps = (const void *)(header + 1);
+    const uint32_t *words = (const void *)(deps + header->dep_count);
+    const char *strings = (const char *)(words + header->word_count);
+    const uint32_t strings_size = header->strings_size;
 
-    free(env_vec[0]);
-    free(env_vec[1]);
-    free(env_vec[2]);
-    free(cmd);
+    /* Every offset lower than strings_size is then a valid string */
+    if (strings[strings_size - 1] != '\0')
+        goto unmap;
 
-    return 0;
-}
+    /* The configuration file is always the first dependency, the cache
+     * must not be used for rules parsed from other files */
+    if (header->dep_count == 0
+     || deps[0].path >= strings_size
+     || strcmp(strings + deps[0].path, conf_file_name) != 0)
+    {
+        log_info("Rule cache '%s' does not belong to '%s'", cache_name, conf_file_name);
+        goto unmap;
+    }
 
-int consume_event_command_output(struct run_event_state *state, const char *dump_dir_name)
-{
-    int r = 0;
-    char buf[256];
-    errno = 0;
-    struct strbuf *cmd_output = state->command_output;
-    while ((r = safe_read(state->command_out_fd, buf, sizeof(buf) - 1)) > 0)
+    for (uint32_t i = 0; i < header->dep_count; ++i)
     {
-        char *newline;
-        char *raw;
-        buf[r] = '\0';
-        raw = buf;
+        if (deps[i].path >= strings_size)
+            goto unmap;
 
-        while ((newline = strchr(raw, '\n')) != NULL)
+        if (!rule_cache_dep_is_current(&deps[i], strings + deps[i].path))
         {
-            *newline = '\0';
-            strbuf_append_str(cmd_output, raw);
-            char *msg = cmd_output->buf;
+            log_info("Rule cache '%s' is out of date: '%s' changed", cache_name, strings + deps[i].path);
+            goto unmap;
+        }
+    }
 
-            char *response = NULL;
+    GList *rules = NULL;
+    uint32_t w = 0;
+    for (uint32_t i = 0; i < header->rule_count; ++i)
+    {
+        if (w + 2 > header->word_count)
+            goto corrupted;
 
-            /* just cut off prefix, no waiting */
-            if (prefixcmp(msg, REPORT_PREFIX_ALERT) == 0)
-            {
-                state->alert_callback(msg + sizeof(REPORT_PREFIX_ALERT) - 1 , state->interaction_param);
-            }
-            /* wait for y/N/f response on the same line */
-            else if (prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO_YESFOREVER) == 0)
-            {
-                /* example:
-                 *   ASK_YES_NO_YESFOREVER ask_before_delete Do you want to delete selected files?
-                 */
-                char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_YESFOREVER) - 1;
-                char *key_end = strchr(key, ' ');
+        const uint32_t cond_count = words[w++];
+        const uint32_t command = words[w++];
+        if (command >= strings_size || cond_count > header->word_count - w)
+            goto corrupted;
 
-                bool ans = false;
+        struct rule *cur_rule = xzalloc(sizeof(*cur_rule));
+        cur_rule->command = xstrdup(strings + command);
+        rules = g_list_prepend(rules, cur_rule);
 
-                if (!key_end)
-                {   /* example:
-                     *  ASK_YES_NO_YESFOREVER Continue?
-                     *
-                     * Print a wraning only and do not scary users with error messages.
-                     */
-                    log_warning("invalid input format (missing option name), using simple ask yes/no");
+        for (uint32_t c = 0; c < cond_count; ++c)
+        {
+            const uint32_t cond = words[w++];
+            if (cond >= strings_size || strchr(strings + cond, '=') == NULL)
+                goto corrupted;
+            cur_rule->conditions = g_list_prepend(cur_rule->conditions, xstrdup(strings + cond));
+        }
+        cur_rule->conditions = g_list_reverse(cur_rule->conditions);
+        parse_rule_conditions(cur_rule);
+    }
 
-                    /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
-                    ans = state->ask_yes_no_callback(key, state->interaction_param);
-                }
-                else
-                {
-                    key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
-                    ans = state->ask_yes_no_yesforever_callback(key, key + strlen(key) + 1, state->interaction_param);
-                    key_end[0] = ' '; /* restore original message, not sure if it is necessary */
-                }
+    *rule_list = g_list_reverse(rules);
+    retval = true;
+    goto unmap;
 
-                response = xstrdup(ans ? "y" : "N");
-            }
-            /* wait for y/N/f/e response on the same line */
-            else if (prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) == 0)
-            {
-                /* example:
-                 *   ASK_YES_NO_SAVE_RESULT ask_before_delete Do you want to delete selected files?
-                 */
-                char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) - 1;
-                char *key_end = strchr(key, ' ');
+ corrupted:
+    log_info("Rule cache '%s' is corrupted", cache_name);
+    free_rule_list(rules);
 
-                bool ans = false;
+ unmap:
+    munmap((void *)data, size);
+ close_fd:
+    close(fd);
+    return retval;
+}
 
-                if (!key_end)
-                {   /* example:
-                     *  ASK_YES_NO_YESFOREVER Continue?
-                     *
-                     * Print a wraning only and do not scary users with error messages.
-                     */
-                    log_warning("invalid input format (missing option name), using simple ask yes/no");
+static uint32_t rule_cache_add_string(char *strings, uint32_t *strings_size, const char *str)
+{
+    const uint32_t offset = *strings_size;
+    const size_t len = strlen(str) + 1;
+    memcpy(strings + offset, str, len);
+    *strings_size += len;
+    return offset;
+}
 
-                    /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
-                    ans = state->ask_yes_no_callback(key, state->interaction_param);
-                }
-                else
-                {
-                    key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
-                    ans = state->ask_yes_no_save_result_callback(key, key + strlen(key) + 1, state->interaction_param);
-                    key_end[0] = ' '; /* restore original message, not sure if it is necessary */
-                }
+static void rule_cache_save(const char *cache_name, GList *rule_list, struct rule_file_deps *deps)
+{
+    /* A file modified in this second can be modified again without
+     * changing its time stamp, cache the rules next time */
+    const time_t now = time(NULL);
+    for (unsigned i = 0; i < deps->files->len; ++i)
+    {
+        struct rule_file_dep *dep = g_ptr_array_index(deps->files, i);
+        if (dep->exists && dep->st.st_mtim.tv_sec >= now)
+            return;
+    }
 
-                response = xstrdup(ans ? "y" : "N");
-            }
-            /* wait for y/N response on the same line */
-            else if (prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO) == 0)
-            {
-                const bool ans = state->ask_yes_no_callback(msg + sizeof(REPORT_PREFIX_ASK_YES_NO) - 1, state->interaction_param);
-                response = xstrdup(ans ? "y" : "N");
-            }
-            /* wait for the string on the same line */
-            else if (prefixcmp(msg, REPORT_PREFIX_ASK) == 0)
-            {
-                response = state->ask_callback(msg + sizeof(REPORT_PREFIX_ASK) - 1, state->interaction_param);
-            }
-            /* set echo off and wait for password on the same line */
-            else if (prefixcmp(msg, REPORT_PREFIX_ASK_PASSWORD) == 0)
-            {
-                response = state->ask_password_callback(msg + sizeof(REPORT_PREFIX_ASK_PASSWORD) - 1, state->interaction_param);
-            }
-            /* no special prefix -> forward to log if applicable
-             * note that callback may take ownership of buf by returning NULL */
-            else if (state->logging_callback)
-            {
-                char *logged = state->logging_callback(xstrdup(msg), state->logging_param);
-                free(logged);
-            }
+    size_t word_count = 0;
+    size_t strings_size = 0;
+    for (unsigned i = 0; i < deps->files->len; ++i)
+        strings_size += strlen(((struct rule_file_dep *)g_ptr_array_index(deps->files, i))->path) + 1;
+    for (GList *iter = rule_list; iter; iter = g_list_next(iter))
+    {
+        struct rule *cur_rule = iter->data;
+        word_count += 2;
+        strings_size += strlen(cur_rule->command) + 1;
+        for (GList *c = cur_rule->conditions; c; c = g_list_next(c))
+        {
+            word_count++;
+            strings_size += strlen(c->data) + 1;
+        }
+    }
 
-            if (response)
-            {
-                size_t len = strlen(response);
-                response[len++] = '\n';
+    if (strings_size >= UINT32_MAX || word_count >= UINT32_MAX)
+        return;
 
-                if (full_write(state->command_in_fd, response, len) != len)
-                {
-                    if (state->error_callback)
-                        state->error_callback("<WRITE ERROR>", state->error_param);
-                    else
-                        perror_msg_and_die("Can't write %zu bytes to child's stdin", len);
-                }
+    const size_t size = sizeof(struct rule_cache_header)
+                      + deps->files->len * sizeof(struct rule_cache_dep)
+                      + word_count * sizeof(uint32_t)
+                      + strings_size;
+    char *data = xzalloc(size);
 
-                free(response);
-            }
+    struct rule_cache_header *header = (void *)data;
+    memcpy(header->magic, RULE_CACHE_MAGIC, sizeof(header->magic));
+    header->dep_count = deps->files->len;
+    header->rule_count = g_list_length(rule_list);
+    header->word_count = word_count;
+    header->strings_size = strings_size;
 
-            strbuf_clear(cmd_output);
+    struct rule_cache_dep *cache_deps = (void *)(header + 1);
+    uint32_t *words = (void *)(cache_deps + header->dep_count);
+    char *strings = (char *)(words + word_count);
+    uint32_t offset = 0;
 
-            /* jump to next line */
-            raw = newline + 1;
-        }
+    for (unsigned i = 0; i < deps->files->len; ++i)
+    {
+        struct rule_file_dep *dep = g_ptr_array_index(deps->files, i);
+        cache_deps[i].path = rule_cache_add_string(strings, &offset, dep->path);
+        cache_deps[i].exists = dep->exists;
+        if (!dep->exists)
+            continue;
+        cache_deps[i].dev = dep->st.st_dev;
+        cache_deps[i].ino = dep->st.st_ino;
+        cache_deps[i].size = dep->st.st_size;
+        cache_deps[i].mtime_sec = dep->st.st_mtim.tv_sec;
+        cache_deps[i].mtime_nsec = dep->st.st_mtim.tv_nsec;
+    }
 
-        /* beginning of next line. the line continues by next read() */
-        strbuf_append_str(cmd_output, raw);
+    uint32_t w = 0;
+    for (GList *iter = rule_list; iter; iter = g_list_next(iter))
+    {
+        struct rule *cur_rule = iter->data;
+        words[w++] = g_list_length(cur_rule->conditions);
+        words[w++] = rule_cache_add_string(strings, &offset, cur_rule->command);
+        for (GList *c = cur_rule->conditions; c; c = g_list_next(c))
+            words[w++] = rule_cache_add_string(strings, &offset, c->data);
     }
 
-    /* Hope that child's stdout fd was set to O_NONBLOCK */
-    if (r == -1 && errno == EAGAIN)
-        return -1;
+    /* Replace the cache atomically, other processes may be reading it */
+    char *cache_dir = g_path_get_dirname(cache_name);
+    char *tmp_name = xasprintf("%s.XXXXXX", cache_name);
+    if (g_mkdir_with_parents(cache_dir, 0700) != 0)
+    {
+        log_info("Can't create directory '%s' for rule cache", cache_dir);
+        goto free_data;
+    }
 
-    strbuf_clear(cmd_output);
+    int fd = mkostemp(tmp_name, O_CLOEXEC);
+    if (fd < 0)
+    {
+        log_info("Can't create rule cache '%s'", tmp_name);
+        goto free_data;
+    }
 
-    /* Wait for child to actually exit, collect status */
-    safe_waitpid(state->command_pid, &(state->process_status), 0);
+    const bool written = full_write(fd, data, size) == size;
+    if (close(fd) != 0 || !written || rename(tmp_name, cache_name) != 0)
+    {
+        log_info("Can't write rule cache '%s'", cache_name);
+        unlink(tmp_name);
+    }
 
-    int retval = WEXITSTATUS(state->process_status);
-    if (WIFSIGNALED(state->process_status))
-        retval = WTERMSIG(state->process_status) + 128;
+ free_data:
+    free(tmp_name);
+    g_free(cache_dir);
+    free(data);
+}
 
-    if (retval == 0 && state->post_run_callback)
-        retval = state->post_run_callback(dump_dir_name, state->post_run_param);
+static void free_rule_file_dep(struct rule_file_dep *dep)
+{
+    free(dep->path);
+    free(dep);
+}
+
+GList *load_rule_list_cached(const char *conf_file_name)
+{
+    if (!rule_cache_is_allowed())
+        return load_rule_file(NULL, conf_file_name, /*recursion_depth:*/ 0, /*deps:*/ NULL);
+
+    GList *rule_list = NULL;
+    char *cache_name = rule_cache_file_name(conf_file_name);
+    if (rule_cache_load(cache_name, conf_file_name, &rule_list))
+    {
+        log_debug("Loaded rules from cache '%s'", cache_name);
+        goto ret;
+    }
+
+    struct rule_file_deps deps = {
+        .files = g_ptr_array_new_with_free_func((GDestroyNotify)free_rule_file_dep),
+    };
+
+    rule_list = load_rule_file(NULL, conf_file_name, /*recursion_depth:*/ 0, &deps);
+    if (!deps.untrackable)
+        rule_cache_save(cache_name, rule_list, &deps);
+
+    g_ptr_array_free(deps.files, TRUE);
+ ret:
+    free(cache_name);
+    return rule_list;
+}
+
+/* Rules grouped by the event they are written for. Matching an event then
+ * costs the number of its rules instead of the size of the whole
+ * configuration, which consists of hundreds of rules for unrelated events.
+ */
+struct rule_index
+{
+    GList *rules;         /* all rules in configuration order, owned */
+    GHashTable *by_event; /* EVENT value -> GList of its rules */
+    GList *any_event;     /* rules without EVENT= condition */
+    /* Sorted names of events, for prefix lookups */
+    GPtrArray *event_names;
+};
+
+static int compare_strings(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+static int compare_rule_order(const void *a, const void *b)
+{
+    const struct rule *ra = a;
+    const struct rule *rb = b;
+    return (ra->order > rb->order) - (ra->order < rb->order);
+}
+
+struct rule_index *rule_index_new(GList *rule_list)
+{
+    struct rule_index *index = xzalloc(sizeof(*index));
+    index->rules = rule_list;
+    index->by_event = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                            NULL, (GDestroyNotify)g_list_free);
+    index->event_names = g_ptr_array_new();
+
+    unsigned order = 0;
+    /* Build the lists backwards and reverse them at the end to keep
+     * the configuration order without quadratic g_list_append() */
+    for (GList *iter = rule_list; iter != NULL; iter = g_list_next(iter))
+    {
+        struct rule *rule = iter->data;
+        rule->order = order++;
+
+        if (rule->event == NULL)
+        {
+            index->any_event = g_list_prepend(index->any_event, rule);
+            continue;
+        }
+
+        GList *rules = g_hash_table_lookup(index->by_event, rule->event);
+        if (rules == NULL)
+            g_ptr_array_add(index->event_names, (gpointer)rule->event);
+        else
+            g_hash_table_steal(index->by_event, rule->event);
+
+        g_hash_table_insert(index->by_event, (gpointer)rule->event, g_list_prepend(rules, rule));
+    }
+
+    index->any_event = g_list_reverse(index->any_event);
+
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    g_hash_table_iter_init(&iter, index->by_event);
+    while (g_hash_table_iter_next(&iter, &key, &value))
+        g_hash_table_iter_replace(&iter, g_list_reverse(value));
+
+    qsort(index->event_names->pdata, index->event_names->len, sizeof(gpointer), compare_strings);
+
+    return index;
+}
+
+struct rule_index *rule_index_load(void)
+{
+    return rule_index_new(load_rule_list_cached(CONF_DIR"/report_event.conf"));
+}
+
+void rule_index_free(struct rule_index *index)
+{
+    if (!index)
+        return;
+
+    g_ptr_array_free(index->event_names, TRUE);
+    g_list_free(index->any_event);
+    g_hash_table_destroy(index->by_event);
+    free_rule_list(index->rules);
+    free(index);
+}
+
+/* Merges the candidates with the rules without EVENT= condition */
+static GList *rule_index_with_any_event(struct rule_index *index, GList *candidates)
+{
+    for (GList *iter = index->any_event; iter != NULL; iter = g_list_next(iter))
+        candidates = g_list_prepend(candidates, iter->data);
+
+    return g_list_sort(candidates, (GCompareFunc)compare_rule_order);
+}
+
+GList *rule_index_lookup(struct rule_index *index, const char *event)
+{
+    GList *candidates = g_list_copy(g_hash_table_lookup(index->by_event, event));
+
+    if (index->any_event == NULL)
+        return candidates;
+
+    return rule_index_with_any_event(index, candidates);
+}
+
+GList *rule_index_lookup_prefix(struct rule_index *index, const char *pfx)
+{
+    const size_t pfx_len = strlen(pfx);
+    const char **names = (const char **)index->event_names->pdata;
+
+    /* Find the first name not sorted before the prefix */
+    size_t lo = 0;
+    size_t hi = index->event_names->len;
+    while (lo < hi)
+    {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (strcmp(names[mid], pfx) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    GList *candidates = NULL;
+    for (; lo < index->event_names->len && strncmp(names[lo], pfx, pfx_len) == 0; ++lo)
+    {
+        GList *rules = g_hash_table_lookup(index->by_event, names[lo]);
+        for (; rules != NULL; rules = g_list_next(rules))
+            candidates = g_list_prepend(candidates, rules->data);
+    }
+
+    return rule_index_with_any_event(index, candidates);
+}
+
+/* Returns 0 if any line of val matches the regex */
+static int regcmp_lines(const char *val, const regex_t *rx)
+{
+    /* Invalid regex matches nothing */
+    if (rx == NULL)
+        return REG_NOMATCH;
+
+    return regexec(rx, val, 0, NULL, /*eflags:*/ 0);
+}
+
+/* Values of dump dir elements used in rule conditions. Every rule of
+ * an event is checked again after each command, so without the cache
+ * elements like "analyzer" or "component" are read once per rule and
+ * command.
+ */
+struct condition_cache
+{
+    GHashTable *values; /* element name -> struct condition_value */
+    /* Incremented whenever a command may have changed the elements */
+    unsigned generation;
+};
+
+struct condition_value
+{
+    char *value;
+    unsigned generation; /* the value is known to be valid in this one */
+    time_t loaded;
+    /* Identification of the file the value was loaded from */
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+};
+
+static void free_condition_value(struct condition_value *cv)
+{
+    free(cv->value);
+    free(cv);
+}
+
+static struct condition_cache *condition_cache_new(void)
+{
+    struct condition_cache *cache = xzalloc(sizeof(*cache));
+    cache->values = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                          free, (GDestroyNotify)free_condition_value);
+    return cache;
+}
+
+static void condition_cache_free(struct condition_cache *cache)
+{
+    if (!cache)
+        return;
+
+    g_hash_table_destroy(cache->values);
+    free(cache);
+}
+
+static bool condition_value_is_current(const struct condition_value *cv, const struct stat *st)
+{
+    /* A file modified in the second the value was loaded in can be
+     * modified again without changing its time stamp, don't trust it. */
+    return cv->ino == st->st_ino
+        && cv->size == st->st_size
+        && cv->mtime.tv_sec == st->st_mtim.tv_sec
+        && cv->mtime.tv_nsec == st->st_mtim.tv_nsec
+        && st->st_mtim.tv_sec < cv->loaded;
+}
+
+/* Returns the value of the element, reads it only if it has been changed
+ * since it was read last time. Missing elements are empty strings.
+ */
+static const char *condition_cache_load(struct condition_cache *cache, struct dump_dir *dd, const char *name)
+{
+    struct condition_value *cv = g_hash_table_lookup(cache->values, name);
+    if (cv && cv->generation == cache->generation)
+        return cv->value;
+
+    struct stat st;
+    if (fstatat(dd->dd_fd, name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+        memset(&st, 0, sizeof(st));
+
+    if (cv && condition_value_is_current(cv, &st))
+    {
+        cv->generation = cache->generation;
+        return cv->value;
+    }
+
+    if (!cv)
+    {
+        cv = xzalloc(sizeof(*cv));
+        g_hash_table_insert(cache->values, xstrdup(name), cv);
+    }
+    else
+        free(cv->value);
+
+    cv->value = dd_load_text_ext(dd, name, DD_FAIL_QUIETLY_ENOENT);
+    cv->generation = cache->generation;
+    cv->loaded = time(NULL);
+    cv->ino = st.st_ino;
+    cv->size = st.st_size;
+    cv->mtime = st.st_mtim;
+
+    return cv->value;
+}
+
+/* Checks conditions of the rule.
+ * Returns 1 if all of them are satisfied, 0 if they are not, and -1 in case
+ * of error (dump_dir can't be opened).
+ *
+ * The dump dir is opened on the first condition which needs it and returned
+ * in *pp_dd, the caller closes it.
+ */
+static int match_rule_conditions(const struct rule *cur_rule,
+        char **pp_event_name,    /* reports EVENT value thru this, if not NULL on entry */
+        struct dump_dir **pp_dd, /* use *pp_dd for access to dump dir */
+        problem_data_t *pd,      /* use *pd for access to problem data, if non-NULL */
+        struct condition_cache *cache, /* values of dump dir elements, if non-NULL */
+        const char *dump_dir_name,
+        const char *pfx,
+        unsigned pfx_len
+)
+{
+    for (unsigned i = 0; i < cur_rule->cond_count; ++i)
+    {
+        const struct rule_condition *cond = &cur_rule->cond_vec[i];
+
+        /* Is it "EVENT=foo"? */
+        if (cond->op == RULE_COND_EVENT)
+        {
+            if (strncmp(cond->value, pfx, pfx_len) != 0)
+                return 0; /* prefix doesn't match */
+            if (pp_event_name)
+            {
+                free(*pp_event_name);
+                *pp_event_name = xstrdup(cond->value);
+            }
+            continue;
+        }
+
+        /* Read from dump dir and compare */
+        if (!*pp_dd && pd == NULL)
+        {
+            /* Without dir to match, we assume match for all conditions */
+            if (!dump_dir_name)
+                continue;
+            *pp_dd = dd_opendir(dump_dir_name, /*flags:*/ DD_OPEN_SHARED);
+            if (!*pp_dd)
+                return -1; /* error (note: dd_opendir logged error msg) */
+        }
+        const char *real_val = NULL;
+        char *free_me = NULL;
+        if (pd != NULL)
+        {
+            /* A missing element is empty as in the dump dir */
+            real_val = problem_data_get_content_or_NULL(pd, cond->name);
+            if (!real_val)
+                real_val = "";
+        }
+        else if (cache != NULL)
+            real_val = condition_cache_load(cache, *pp_dd, cond->name);
+        else
+            free_me = (char *)(real_val = dd_load_text_ext(*pp_dd, cond->name, DD_FAIL_QUIETLY_ENOENT));
+        int vals_differ = cond->op == RULE_COND_REGEX ? regcmp_lines(real_val, cond->regex)
+                                                      : strcmp(real_val, cond->value);
+        free(free_me);
+        if (cond->op == RULE_COND_NE)
+            vals_differ = !vals_differ;
+
+        /* Do values match? */
+        if (vals_differ) /* no */
+            return 0;
+
+        /* We are here if current condition is satisfied */
+    }
+    /* We are here if all conditions are satisfied */
+    return 1;
+}
+
+/* Checks rules in *pp_rule_list, starting from first (remaining) rule,
+ * until it finds a rule with all conditions satisfied.
+ * In this case, it removes this rule from the list and returns a copy of its
+ * cmd. Else (if it didn't find such rule), it returns NULL.
+ * In case of error (dump_dir can't be opened), returns NULL.
+ *
+ * The rules are owned by a struct rule_index, *pp_rule_list holds only
+ * the candidates returned by rule_index_lookup*().
+ *
+ * Intended usage:
+ * index = rule_index_new(load_rule_list(...));
+ * list = rule_index_lookup(index, event);
+ * while ((cmd = pop_next_command(&list, ...)) != NULL)
+ *     run(cmd);
+ */
+static char* pop_next_command(GList **pp_rule_list,
+        char **pp_event_name,    /* reports EVENT value thru this, if not NULL on entry */
+        struct dump_dir **pp_dd, /* use *pp_dd for access to dump dir, if non-NULL */
+        problem_data_t *pd,      /* use *pd for access to problem data, if non-NULL */
+        struct condition_cache *cache, /* values of dump dir elements, if non-NULL */
+        const char *dump_dir_name,
+        const char *pfx,
+        unsigned pfx_len
+)
+{
+    /* It is an error to pass both, but we can recover from it and use only
+     * problem_data_t in that case */
+    if (pp_dd != NULL && pd != NULL)
+        error_msg("BUG: both dump dir and problem data passed to %s()", __func__);
+
+    char *command = NULL;
+    struct dump_dir *dd = pp_dd ? *pp_dd : NULL;
+
+    for (GList *rule_list = *pp_rule_list; rule_list; rule_list = rule_list->next)
+    {
+        struct rule *cur_rule = rule_list->data;
+
+        const int r = match_rule_conditions(cur_rule, pp_event_name, &dd, pd, cache,
+                                            dump_dir_name, pfx, pfx_len);
+        if (r < 0)
+        {
+            g_list_free(*pp_rule_list);
+            *pp_rule_list = NULL;
+            break;
+        }
+
+        if (r > 0)
+        {
+            /* We found rule to run, remove it and return its command */
+            *pp_rule_list = g_list_delete_link(*pp_rule_list, rule_list);
+            command = xstrdup(cur_rule->command);
+            break;
+        }
+    }
+
+    if (pp_dd)
+        *pp_dd = dd;
+    else
+        dd_close(dd);
+    return command;
+}
+
+void free_commands(struct run_event_state *state)
+{
+    /* No command of the event runs anymore */
+    write_command_stats(state);
+
+    g_list_free(state->rule_list);
+    state->rule_list = NULL;
+    rule_index_free(state->rule_index);
+    state->rule_index = NULL;
+    condition_cache_free(state->condition_cache);
+    state->condition_cache = NULL;
+    state->command_out_fd = -1;
+    state->command_pid = 0;
+}
+
+int prepare_commands(struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event
+) {
+    free_commands(state);
+
+    state->children_count = 0;
+    strbuf_clear(state->command_output);
+
+    struct rule_index *index = state->shared_rule_index;
+    if (!index)
+        index = state->rule_index = rule_index_load();
+    state->rule_list = rule_index_lookup(index, event);
+    state->condition_cache = condition_cache_new();
+    return state->rule_list != NULL;
+}
+
+/* Resources used by commands */
+
+static void start_command_stats(struct run_event_command_stats *stats,
+                struct timespec *start,
+                const char *event,
+                const char *command
+) {
+    free_command_stats(stats);
+    stats->event = xstrdup(event);
+    stats->command = xstrdup(command);
+    clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static void free_command_stats(struct run_event_command_stats *stats)
+{
+    free(stats->event);
+    free(stats->command);
+    memset(stats, 0, sizeof(*stats));
+}
+
+/* Waits for the command like safe_waitpid() and records its resource usage */
+static void wait_for_command(pid_t pid,
+                int *status,
+                struct run_event_command_stats *stats,
+                const struct timespec *start
+) {
+    struct rusage usage;
+    memset(&usage, 0, sizeof(usage));
+    while (wait4(pid, status, 0, &usage) < 0)
+    {
+        if (errno != EINTR)
+        {
+            perror_msg("wait4");
+            break;
+        }
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    stats->status = *status;
+    stats->wall_time = (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+    stats->user_time = usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6;
+    stats->system_time = usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+    stats->max_rss = usage.ru_maxrss;
+}
+
+static void strbuf_append_json_string(struct strbuf *buf, const char *str)
+{
+    strbuf_append_char(buf, '"');
+    for (const unsigned char *c = (const unsigned char *)str; *c; ++c)
+    {
+        if (*c == '"' || *c == '\\')
+            strbuf_append_strf(buf, "\\%c", *c);
+        else if (*c < 0x20)
+            strbuf_append_strf(buf, "\\u%04x", *c);
+        else
+            strbuf_append_char(buf, *c);
+    }
+    strbuf_append_char(buf, '"');
+}
+
+/* Adds the stats as a JSON line to the lines written by write_command_stats() */
+static void save_command_stats(struct run_event_state *state,
+                const char *dump_dir_name,
+                const struct run_event_command_stats *stats
+) {
+    /* The commands of one event run in the same dump dir */
+    if (state->command_stats_dump_dir_name && strcmp(state->command_stats_dump_dir_name, dump_dir_name) != 0)
+        write_command_stats(state);
+    if (!state->command_stats_dump_dir_name)
+        state->command_stats_dump_dir_name = xstrdup(dump_dir_name);
+    if (!state->command_stats_lines)
+        state->command_stats_lines = strbuf_new();
+
+    struct strbuf *line = state->command_stats_lines;
+    strbuf_append_strf(line, "{\"time\":%lu,\"event\":", (unsigned long)time(NULL));
+    strbuf_append_json_string(line, stats->event);
+    strbuf_append_str(line, ",\"command\":");
+    strbuf_append_json_string(line, stats->command);
+    /* JSON numbers need '.' whatever LC_NUMERIC says */
+    char wall_time[G_ASCII_DTOSTR_BUF_SIZE];
+    char user_time[G_ASCII_DTOSTR_BUF_SIZE];
+    char system_time[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_formatd(wall_time, sizeof(wall_time), "%.6f", stats->wall_time);
+    g_ascii_formatd(user_time, sizeof(user_time), "%.6f", stats->user_time);
+    g_ascii_formatd(system_time, sizeof(system_time), "%.6f", stats->system_time);
+    strbuf_append_strf(line, ",\"status\":%d,\"wall_time\":%s,\"user_time\":%s,\"system_time\":%s"
+                             ",\"max_rss\":%ld,\"output_bytes\":%llu,\"prompts\":%u}\n",
+                       stats->status, wall_time, user_time, system_time,
+                       stats->max_rss, stats->output_bytes, stats->prompts);
+}
+
+/* Appends the lines saved by save_command_stats() to FILENAME_EVENT_STATS.
+ *
+ * Called when no command of the event runs. A running command usually holds
+ * the lock of the dump dir, so the lines can't be written after every command.
+ */
+static void write_command_stats(struct run_event_state *state)
+{
+    if (!state->command_stats_dump_dir_name)
+        return;
+
+    struct dump_dir *dd = dd_opendir(state->command_stats_dump_dir_name, DD_FAIL_QUIETLY_ENOENT
+                                                                        | DD_FAIL_QUIETLY_EACCES);
+    if (!dd || !dd->locked)
+    {
+        log_notice("Can't lock '%s', stats of the commands not saved", state->command_stats_dump_dir_name);
+        goto ret;
+    }
+
+    char *stats_log = dd_load_text_ext(dd, FILENAME_EVENT_STATS, DD_FAIL_QUIETLY_ENOENT);
+    unsigned len = strlen(stats_log);
+    if (len != 0 && stats_log[len - 1] != '\n')
+        stats_log = append_to_malloced_string(stats_log, "\n");
+    stats_log = append_to_malloced_string(stats_log, state->command_stats_lines->buf);
+
+    /* Trim log according to size watermarks of FILENAME_EVENT_LOG */
+    len = strlen(stats_log);
+    char *new_log = stats_log;
+    if (len > EVENT_LOG_HIGH_WATERMARK)
+    {
+        new_log += len - EVENT_LOG_LOW_WATERMARK;
+        new_log = strchrnul(new_log, '\n');
+        if (new_log[0])
+            new_log++;
+    }
+
+    dd_save_text(dd, FILENAME_EVENT_STATS, new_log);
+    free(stats_log);
+
+ ret:
+    dd_close(dd);
+    strbuf_clear(state->command_stats_lines);
+    free(state->command_stats_dump_dir_name);
+    state->command_stats_dump_dir_name = NULL;
+}
+
+static void report_command_stats(struct run_event_state *state,
+                const char *dump_dir_name,
+                const struct run_event_command_stats *stats
+) {
+    if (state->command_stats_callback)
+        state->command_stats_callback(stats, state->command_stats_param);
+
+    if (state->log_command_stats)
+        save_command_stats(state, dump_dir_name, stats);
+}
+
+/* Starts the command in shell with stdin and stdout connected to pipefds,
+ * extra_env is added to the environment */
+static pid_t spawn_event_command(const char *cmd,
+                const char *dump_dir_name,
+                const char *event,
+                unsigned execflags,
+                char **extra_env,
+                int pipefds[2]
+) {
+    log_info("Next command: '%s'", cmd);
+
+    unsigned extra_count = 0;
+    while (extra_env && extra_env[extra_count])
+        extra_count++;
+
+    /* Export some useful environment variables for children */
+    char **env_vec = xmalloc((extra_count + 4) * sizeof(env_vec[0]));
+    if (extra_count)
+        memcpy(env_vec + 3, extra_env, extra_count * sizeof(env_vec[0]));
+    /* Just exporting dump_dir_name isn't always ok: it can be "."
+     * and some children want to cd to other directory but still
+     * be able to find problem directory by using $DUMP_DIR...
+     */
+    char *full_name = realpath(dump_dir_name, NULL);
+    env_vec[0] = xasprintf("DUMP_DIR=%s", (full_name ? full_name : dump_dir_name));
+    free(full_name);
+    env_vec[1] = xasprintf("EVENT=%s", event);
+    env_vec[2] = xasprintf("REPORT_CLIENT_SLAVE=1");
+    env_vec[3 + extra_count] = NULL;
+
+    /* The command may modify the items behind our back */
+    dump_dir_remove_index(dump_dir_name);
+
+    /* Simple commands like "abrt-action-save-package-data" are executed
+     * directly, without starting shell first */
+    char **words = split_shell_command(cmd);
+
+    char *sh_argv[4];
+    sh_argv[0] = (char*)"/bin/sh"; // TODO: honor $SHELL?
+    sh_argv[1] = (char*)"-c";
+    sh_argv[2] = (char*)cmd;
+    sh_argv[3] = NULL;
+
+    pid_t pid = fork_execv_on_steroids(
+                EXECFLG_INPUT | EXECFLG_OUTPUT | EXECFLG_ERR2OUT | execflags,
+                words ? words : sh_argv,
+                pipefds,
+                /* env_vec: */ env_vec,
+                /* dir: */ dump_dir_name,
+                /* uid(unused): */ 0
+    );
+
+    string_vector_free(words);
+    free(env_vec[0]);
+    free(env_vec[1]);
+    free(env_vec[2]);
+    free(env_vec);
+
+    return pid;
+}
+
+/* Starts cmd as the current command of the state */
+static void spawn_command(struct run_event_state *state,
+                const char *cmd,
+                const char *dump_dir_name,
+                const char *event,
+                unsigned execflags
+) {
+    /* The command may change the elements, check them before using
+     * the values for the next one */
+    if (state->condition_cache)
+        state->condition_cache->generation++;
+
+    /* We count it even if fork fails. The counter isn't meant
+     * to count *successful* forks, it is meant to let caller know
+     * whether the event we run has *any* handlers configured, or not.
+     */
+    state->children_count++;
+
+    start_command_stats(&state->command_stats, &state->command_start, event, cmd);
+
+    int pipefds[2];
+    state->command_pid = spawn_event_command(cmd, dump_dir_name, event, execflags, state->env_vec, pipefds);
+    state->command_out_fd = pipefds[0];
+    state->command_in_fd = pipefds[1];
+}
+
+int spawn_next_command(struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event,
+                unsigned execflags
+) {
+    char *cmd = pop_next_command(&state->rule_list,
+                NULL,          /* don't return event_name */
+                NULL,          /* NULL dd: we match by... */
+                NULL,          /* no problem data */
+                state->condition_cache, /* reuse values read for previous commands */
+                dump_dir_name, /* ...dirname */
+                event, strlen(event)+1 /* for this event name exactly (not prefix) */
+    );
+    if (!cmd)
+        return -1;
+
+    spawn_command(state, cmd, dump_dir_name, event, execflags);
+    free(cmd);
+
+    return 0;
+}
+
+/* Passes a line of command's output to the callbacks and writes the response
+ * to in_fd. The line is modified but restored afterwards.
+ * Returns true if the line asked for a response.
+ */
+static bool handle_command_output_line(struct run_event_state *state, char *msg, int in_fd)
+{
+    char *response = NULL;
+
+    /* just cut off prefix, no waiting */
+    if (prefixcmp(msg, REPORT_PREFIX_ALERT) == 0)
+    {
+        state->alert_callback(msg + sizeof(REPORT_PREFIX_ALERT) - 1 , state->interaction_param);
+    }
+    /* wait for y/N/f response on the same line */
+    else if (prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO_YESFOREVER) == 0)
+    {
+        /* example:
+         *   ASK_YES_NO_YESFOREVER ask_before_delete Do you want to delete selected files?
+         */
+        char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_YESFOREVER) - 1;
+        char *key_end = strchr(key, ' ');
+
+        bool ans = false;
+
+        if (!key_end)
+        {   /* example:
+             *  ASK_YES_NO_YESFOREVER Continue?
+             *
+             * Print a wraning only and do not scary users with error messages.
+             */
+            log_warning("invalid input format (missing option name), using simple ask yes/no");
+
+            /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
+            ans = state->ask_yes_no_callback(key, state->interaction_param);
+        }
+        else
+        {
+            key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
+            ans = state->ask_yes_no_yesforever_callback(key, key + strlen(key) + 1, state->interaction_param);
+            key_end[0] = ' '; /* restore original message, not sure if it is necessary */
+        }
+
+        response = xstrdup(ans ? "y" : "N");
+    }
+    /* wait for y/N/f/e response on the same line */
+    else if (prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) == 0)
+    {
+        /* example:
+         *   ASK_YES_NO_SAVE_RESULT ask_before_delete Do you want to delete selected files?
+         */
+        char *key = msg + sizeof(REPORT_PREFIX_ASK_YES_NO_SAVE_RESULT) - 1;
+        char *key_end = strchr(key, ' ');
+
+        bool ans = false;
+
+        if (!key_end)
+        {   /* example:
+             *  ASK_YES_NO_YESFOREVER Continue?
+             *
+             * Print a wraning only and do not scary users with error messages.
+             */
+            log_warning("invalid input format (missing option name), using simple ask yes/no");
+
+            /* can't simply use 'goto ask_yes_no' because of different lenght of prefixes */
+            ans = state->ask_yes_no_callback(key, state->interaction_param);
+        }
+        else
+        {
+            key_end[0] = '\0'; /* split 'key msg' to 'key' and 'msg' */
+            ans = state->ask_yes_no_save_result_callback(key, key + strlen(key) + 1, state->interaction_param);
+            key_end[0] = ' '; /* restore original message, not sure if it is necessary */
+        }
+
+        response = xstrdup(ans ? "y" : "N");
+    }
+    /* wait for y/N response on the same line */
+    else if (prefixcmp(msg, REPORT_PREFIX_ASK_YES_NO) == 0)
+    {
+        const bool ans = state->ask_yes_no_callback(msg + sizeof(REPORT_PREFIX_ASK_YES_NO) - 1, state->interaction_param);
+        response = xstrdup(ans ? "y" : "N");
+    }
+    /* wait for the string on the same line */
+    else if (prefixcmp(msg, REPORT_PREFIX_ASK) == 0)
+    {
+        response = state->ask_callback(msg + sizeof(REPORT_PREFIX_ASK) - 1, state->interaction_param);
+    }
+    /* set echo off and wait for password on the same line */
+    else if (prefixcmp(msg, REPORT_PREFIX_ASK_PASSWORD) == 0)
+    {
+        response = state->ask_password_callback(msg + sizeof(REPORT_PREFIX_ASK_PASSWORD) - 1, state->interaction_param);
+    }
+    /* no special prefix -> forward to log if applicable
+     * note that callback may take ownership of buf by returning NULL */
+    else if (state->logging_callback)
+    {
+        char *logged = state->logging_callback(xstrdup(msg), state->logging_param);
+        free(logged);
+    }
+
+    if (!response)
+        return false;
+
+    size_t len = strlen(response);
+    response[len++] = '\n';
+
+    if (full_write(in_fd, response, len) != len)
+    {
+        if (state->error_callback)
+            state->error_callback("<WRITE ERROR>", state->error_param);
+        else
+            perror_msg_and_die("Can't write %zu bytes to child's stdin", len);
+    }
+
+    free(response);
+    return true;
+}
+
+/* Reads one chunk of a command's output into buf and passes complete lines to
+ * handle_command_output_line(). The lines are split in place; only the
+ * incomplete last line is copied to cmd_output to be continued by the next
+ * read. Returns the result of read().
+ */
+static ssize_t read_command_output_chunk(struct run_event_state *state,
+                int out_fd,
+                int in_fd,
+                struct strbuf *cmd_output,
+                struct run_event_command_stats *stats,
+                char *buf,
+                size_t buf_size
+) {
+    const ssize_t r = safe_read(out_fd, buf, buf_size - 1);
+    if (r <= 0)
+        return r;
+
+    stats->output_bytes += r;
+
+    char *raw = buf;
+    char *const end = buf + r;
+    char *newline;
+    while ((newline = memchr(raw, '\n', end - raw)) != NULL)
+    {
+        *newline = '\0';
+        if (cmd_output->len == 0)
+            stats->prompts += handle_command_output_line(state, raw, in_fd);
+        else
+        {
+            /* the line started in the previous read() */
+            strbuf_append_str(cmd_output, raw);
+            stats->prompts += handle_command_output_line(state, cmd_output->buf, in_fd);
+            strbuf_clear(cmd_output);
+        }
+
+        /* jump to next line */
+        raw = newline + 1;
+    }
+
+    /* beginning of next line. the line continues by next read() */
+    if (raw != end)
+    {
+        *end = '\0';
+        strbuf_append_str(cmd_output, raw);
+    }
+
+    return r;
+}
+
+/* Reads the output of a command until EOF or EAGAIN, passes its lines to
+ * the callbacks and writes responses to in_fd.
+ * Returns the result of the last read, i.e. -1 with errno EAGAIN or 0.
+ */
+static int read_command_output(struct run_event_state *state,
+                int out_fd,
+                int in_fd,
+                struct strbuf *cmd_output,
+                struct run_event_command_stats *stats
+) {
+    ssize_t r;
+    char buf[PIPE_BUF];
+    errno = 0;
+    while ((r = read_command_output_chunk(state, out_fd, in_fd, cmd_output, stats, buf, sizeof(buf))) > 0)
+        continue;
+
+    return r;
+}
+
+/* Returns exit code of the command, or return value of post_run_callback */
+static int command_exit_code(struct run_event_state *state, const char *dump_dir_name)
+{
+    int retval = WEXITSTATUS(state->process_status);
+    if (WIFSIGNALED(state->process_status))
+        retval = WTERMSIG(state->process_status) + 128;
+
+    if (retval == 0 && state->post_run_callback)
+        retval = state->post_run_callback(dump_dir_name, state->post_run_param);
+
+    return retval;
+}
+
+int consume_event_command_output(struct run_event_state *state, const char *dump_dir_name)
+{
+    struct strbuf *cmd_output = state->command_output;
+    int r = read_command_output(state, state->command_out_fd, state->command_in_fd, cmd_output,
+                                &state->command_stats);
+
+    /* Hope that child's stdout fd was set to O_NONBLOCK */
+    if (r == -1 && errno == EAGAIN)
+        return -1;
+
+    strbuf_clear(cmd_output);
+
+    /* Wait for child to actually exit, collect status */
+    wait_for_command(state->command_pid, &(state->process_status), &state->command_stats, &state->command_start);
+    report_command_stats(state, dump_dir_name, &state->command_stats);
+
+    return command_exit_code(state, dump_dir_name);
+}
+
+/* Concurrent execution of annotated rules
+ *
+ * Rules with ID= or AFTER= may run concurrently. Such a rule waits for the
+ * earlier rules named in its AFTER= and for the last earlier rule without
+ * annotations. A rule without annotations waits for all earlier rules and
+ * runs alone.
+ *
+ * As in the serial execution, conditions of a rule are checked directly
+ * before it is started and a rule which doesn't match is checked again after
+ * every finished command. A rule which doesn't match while nothing is running
+ * doesn't hold back the rules waiting for it anymore. The conditions are not
+ * checked while a running command holds the lock of the dump dir.
+ */
+enum {
+    SCHEDULED_PENDING,
+    SCHEDULED_RUNNING,
+    SCHEDULED_DONE,
+};
+
+struct scheduled_rule
+{
+    struct rule *rule;
+    int status;
+    bool skipped;   /* didn't match while nothing was running */
+    GList *deps;    /* struct scheduled_rule the rule waits for */
+
+    /* The running command */
+    pid_t pid;
+    int out_fd;
+    int in_fd;
+    struct strbuf *output;
+    struct run_event_command_stats stats;
+    struct timespec start;
+};
+
+static bool scheduled_rule_is_ready(const struct scheduled_rule *sr)
+{
+    for (GList *iter = sr->deps; iter; iter = g_list_next(iter))
+    {
+        const struct scheduled_rule *dep = iter->data;
+        if (dep->status != SCHEDULED_DONE && !dep->skipped)
+            return false;
+    }
+
+    return true;
+}
+
+static void schedule_rules(struct scheduled_rule *rules, GList *rule_list)
+{
+    struct scheduled_rule *barrier = NULL;
+    unsigned i = 0;
+    for (GList *iter = rule_list; iter; iter = g_list_next(iter), ++i)
+    {
+        struct scheduled_rule *sr = &rules[i];
+        sr->rule = iter->data;
+        sr->status = SCHEDULED_PENDING;
+        sr->out_fd = -1;
+        sr->in_fd = -1;
+
+        if (!sr->rule->annotated)
+        {
+            for (unsigned j = 0; j < i; ++j)
+                sr->deps = g_list_prepend(sr->deps, &rules[j]);
+            barrier = sr;
+            continue;
+        }
+
+        if (barrier)
+            sr->deps = g_list_prepend(sr->deps, barrier);
+
+        for (GList *name = sr->rule->after; name; name = g_list_next(name))
+        {
+            bool found = false;
+            for (unsigned j = 0; j < i; ++j)
+            {
+                if (rules[j].rule->id && strcmp(rules[j].rule->id, name->data) == 0)
+                {
+                    sr->deps = g_list_prepend(sr->deps, &rules[j]);
+                    found = true;
+                }
+            }
+
+            if (!found)
+                log_info("No command with ID '%s' precedes '%s'", (char *)name->data, sr->rule->command);
+        }
+    }
+}
+
+/* Does the rule compare elements of the dump dir? */
+static bool rule_has_element_conditions(const struct rule *rule)
+{
+    for (unsigned i = 0; i < rule->cond_count; ++i)
+        if (rule->cond_vec[i].op != RULE_COND_EVENT)
+            return true;
+
+    return false;
+}
+
+static int run_commands_concurrently(struct run_event_state *state,
+                const char *dump_dir_name,
+                const char *event
+) {
+    const unsigned count = g_list_length(state->rule_list);
+    struct scheduled_rule *rules = xzalloc(count * sizeof(*rules));
+    struct pollfd *pfds = xzalloc(count * sizeof(*pfds));
+    struct scheduled_rule **polled = xzalloc(count * sizeof(*polled));
+    schedule_rules(rules, state->rule_list);
+
+    const unsigned pfx_len = strlen(event) + 1; /* for this event name exactly (not prefix) */
+    unsigned running = 0;
+    bool barrier_running = false;
+    bool stop = false;
+    int retval = 0;
+
+    for (;;)
+    {
+        /* Start every ready rule whose conditions are satisfied */
+        struct dump_dir *dd = NULL;
+        bool dd_locked = false;
+        for (unsigned i = 0; i < count && !stop && !barrier_running; ++i)
+        {
+            struct scheduled_rule *sr = &rules[i];
+            if (sr->status != SCHEDULED_PENDING
+             || running >= state->max_concurrent_commands
+             || (!sr->rule->annotated && running > 0)
+             || !scheduled_rule_is_ready(sr))
+                continue;
+
+            /* A running command may hold the lock of the dump dir. Waiting
+             * for it would stop reading the output of the commands and
+             * answering their questions, and the command would wait for us
+             * if its output fills the pipe. Check the rule again after the
+             * next output or exit of a command.
+             */
+            if (!dd && running > 0 && dump_dir_name && rule_has_element_conditions(sr->rule))
+            {
+                if (dd_locked)
+                    continue;
+
+                dd = dd_opendir(dump_dir_name, DD_OPEN_SHARED | DD_DONT_WAIT_FOR_LOCK);
+                if (!dd)
+                {
+                    if (errno == EAGAIN)
+                        dd_locked = true;
+                    else
+                        stop = true;
+                    continue;
+                }
+            }
+
+            const int r = match_rule_conditions(sr->rule, NULL, &dd, NULL, state->condition_cache,
+                                                dump_dir_name, event, pfx_len);
+            if (r < 0)
+                stop = true;
+            if (r <= 0)
+                continue;
+
+            state->children_count++;
+            start_command_stats(&sr->stats, &sr->start, event, sr->rule->command);
+            int pipefds[2];
+            sr->pid = spawn_event_command(sr->rule->command, dump_dir_name, event, /*execflags:*/ 0, state->env_vec, pipefds);
+            sr->out_fd = pipefds[0];
+            sr->in_fd = pipefds[1];
+            ndelay_on(sr->out_fd);
+            sr->output = strbuf_new();
+            sr->status = SCHEDULED_RUNNING;
+            running++;
+            barrier_running = !sr->rule->annotated;
+
+            /* The command may change the elements */
+            state->condition_cache->generation++;
+        }
+        dd_close(dd);
+
+        if (running == 0)
+        {
+            if (stop)
+                break;
+
+            /* Nothing started and nothing runs, so the ready rules don't
+             * match now. Release the rules waiting for them. Going backwards
+             * keeps the rules released by this loop unmarked, their
+             * conditions haven't been checked yet.
+             */
+            bool released = false;
+            for (unsigned i = count; i-- > 0; )
+            {
+                struct scheduled_rule *sr = &rules[i];
+                if (sr->status == SCHEDULED_PENDING && !sr->skipped && scheduled_rule_is_ready(sr))
+                {
+                    sr->skipped = true;
+                    released = true;
+                }
+            }
+
+            if (!released)
+                break;
+            continue;
+        }
+
+        /* Multiplex the output of the running commands */
+        unsigned polled_count = 0;
+        for (unsigned i = 0; i < count; ++i)
+        {
+            if (rules[i].status != SCHEDULED_RUNNING)
+                continue;
+            pfds[polled_count].fd = rules[i].out_fd;
+            pfds[polled_count].events = POLLIN;
+            pfds[polled_count].revents = 0;
+            polled[polled_count++] = &rules[i];
+        }
+
+        if (poll(pfds, polled_count, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror_msg_and_die("poll");
+        }
+
+        for (unsigned i = 0; i < polled_count; ++i)
+        {
+            if (pfds[i].revents == 0)
+                continue;
+
+            struct scheduled_rule *sr = polled[i];
+            const int r = read_command_output(state, sr->out_fd, sr->in_fd, sr->output, &sr->stats);
+            if (r == -1 && errno == EAGAIN)
+                continue;
+
+            close(sr->out_fd);
+            close(sr->in_fd);
+            strbuf_free(sr->output);
+            sr->output = NULL;
+
+            /* Wait for child to actually exit, collect status */
+            wait_for_command(sr->pid, &(state->process_status), &sr->stats, &sr->start);
+            report_command_stats(state, dump_dir_name, &sr->stats);
+            free_command_stats(&sr->stats);
+            const int exit_code = command_exit_code(state, dump_dir_name);
+
+            sr->status = SCHEDULED_DONE;
+            running--;
+            if (!sr->rule->annotated)
+                barrier_running = false;
+            state->condition_cache->generation++;
+
+            /* Don't start anything after the first failure */
+            if (exit_code != 0 && retval == 0)
+            {
+                retval = exit_code;
+                stop = true;
+            }
+        }
+    }
+
+    for (unsigned i = 0; i < count; ++i)
+        g_list_free(rules[i].deps);
+    free(polled);
+    free(pfds);
+    free(rules);
 
     return retval;
 }
 
+/* Cleans up after the last command of the event */
+static void finish_commands(struct run_event_state *state, const char *dump_dir_name)
+{
+    free_commands(state);
+
+    /* The commands removed the index of items, bring it back if nobody else
+     * holds the directory (the event could have also deleted it).
+     */
+    if (state->children_count != 0)
+    {
+        struct dump_dir *dd = dd_opendir(dump_dir_name, DD_OPEN_READONLY
+                                                       | DD_DONT_WAIT_FOR_LOCK
+                                                       | DD_FAIL_QUIETLY_ENOENT
+                                                       | DD_FAIL_QUIETLY_EACCES);
+        if (dd && dd->locked)
+            dd_rebuild_index(dd);
+        dd_close(dd);
+    }
+}
+
 /* Synchronous command execution:
  */
 int run_event_on_dir_name(struct run_event_state *state,
@@ -705,51 +1977,340 @@ int run_event_on_dir_name(struct run_event_state *state,
 ) {
     prepare_commands(state, dump_dir_name, event);
 
-    /* Execute every command in shell */
+    bool annotated = false;
+    for (GList *iter = state->rule_list; iter && !annotated; iter = g_list_next(iter))
+        annotated = ((struct rule *)iter->data)->annotated;
 
     int retval = 0;
-    while (spawn_next_command(state, dump_dir_name, event, /*execflags:*/ 0) >= 0)
+    if (annotated && state->max_concurrent_commands > 1)
+        retval = run_commands_concurrently(state, dump_dir_name, event);
+    else
     {
-        retval = consume_event_command_output(state, dump_dir_name);
-        if (retval != 0)
-            break;
+        /* Execute every command in shell */
+        while (spawn_next_command(state, dump_dir_name, event, /*execflags:*/ 0) >= 0)
+        {
+            retval = consume_event_command_output(state, dump_dir_name);
+            if (retval != 0)
+                break;
+        }
     }
 
-    free_commands(state);
+    finish_commands(state, dump_dir_name);
 
     return retval;
 }
 
-int run_event_on_problem_data(struct run_event_state *state, problem_data_t *data, const char *event)
+static char *save_problem_data_to_dump_dir(problem_data_t *data)
 {
-    state->children_count = 0;
-
     struct dump_dir *dd = create_dump_dir_from_problem_data(data, NULL);
     if (!dd)
-        return -1;
+        return NULL;
     char *dir_name = xstrdup(dd->dd_dirname);
     dd_close(dd);
+    return dir_name;
+}
+
+/* Runs the commands of the event on the problem data.
+ *
+ * Reporters installed as plugins (see reporter_plugin.h) are called in
+ * process with the data. Before the first command which has to be executed
+ * the data are saved to a new dump directory returned in *dir_name, the rest
+ * of the commands runs on it. post_run_callback isn't called for plugins.
+ */
+static int run_commands_on_problem_data(struct run_event_state *state,
+                problem_data_t *data,
+                const char *event,
+                char **dir_name
+) {
+    prepare_commands(state, NULL, event);
+
+    bool annotated = false;
+    for (GList *iter = state->rule_list; iter && !annotated; iter = g_list_next(iter))
+        annotated = ((struct rule *)iter->data)->annotated;
+
+    int retval = 0;
+    if (annotated && state->max_concurrent_commands > 1)
+    {
+        *dir_name = save_problem_data_to_dump_dir(data);
+        if (!*dir_name)
+        {
+            free_commands(state);
+            return -1;
+        }
+        retval = run_commands_concurrently(state, *dir_name, event);
+        goto ret;
+    }
+
+    const unsigned pfx_len = strlen(event) + 1; /* for this event name exactly (not prefix) */
+    while (retval == 0)
+    {
+        char *cmd = pop_next_command(&state->rule_list,
+                    NULL, NULL,
+                    *dir_name ? NULL : data,
+                    state->condition_cache,
+                    *dir_name,
+                    event, pfx_len
+        );
+        if (!cmd)
+            break;
+
+        const struct reporter_plugin *plugin = NULL;
+        char **argv = *dir_name ? NULL : split_shell_command(cmd);
+        if (argv)
+            plugin = find_reporter_plugin(argv[0]);
+
+        if (plugin)
+        {
+            state->children_count++;
+            const int exit_code = run_reporter_plugin(plugin, argv, data, event, state);
+            state->process_status = W_EXITCODE(exit_code & 0xff, 0);
+            retval = WEXITSTATUS(state->process_status);
+        }
+        else
+        {
+            if (!*dir_name)
+                *dir_name = save_problem_data_to_dump_dir(data);
+
+            if (*dir_name)
+            {
+                spawn_command(state, cmd, *dir_name, event, /*execflags:*/ 0);
+                retval = consume_event_command_output(state, *dir_name);
+                close(state->command_out_fd);
+                close(state->command_in_fd);
+            }
+            else
+                retval = -1;
+        }
+
+        string_vector_free(argv);
+        free(cmd);
+    }
+
+ ret:
+    if (*dir_name)
+        finish_commands(state, *dir_name);
+    else
+        free_commands(state);
+
+    return retval;
+}
+
+int run_event_on_problem_data(struct run_event_state *state, problem_data_t *data, const char *event)
+{
+    state->children_count = 0;
 
-    int r = run_event_on_dir_name(state, dir_name, event);
+    char *dir_name = NULL;
+    int r = run_commands_on_problem_data(state, data, event, &dir_name);
 
-    g_hash_table_remove_all(data);
-    dd = dd_opendir(dir_name, /*flags:*/ 0);
-    free(dir_name);
-    if (dd)
+    /* Some commands ran on a dump directory, they could have changed it */
+    if (dir_name)
     {
-        problem_data_load_from_dump_dir(data, dd, NULL);
-        dd_delete(dd);
+        g_hash_table_remove_all(data);
+        struct dump_dir *dd = dd_opendir(dir_name, /*flags:*/ 0);
+        free(dir_name);
+        if (dd)
+        {
+            problem_data_load_from_dump_dir(data, dd, NULL);
+            dd_delete(dd);
+        }
     }
 
     return r;
 }
 
 
+/* Event loop
+ *
+ * Each added state is a job running the commands of an event one after
+ * another. The stdout of the running command of every job is registered in
+ * epoll. A readable command is read once per wake up, so a command writing
+ * lots of output can't hold the others back, into a buffer shared by all jobs
+ * where its lines are handled without copying.
+ */
+#define RUN_EVENT_LOOP_BUFFER_SIZE (64 * 1024)
+#define RUN_EVENT_LOOP_MAX_EVENTS 64
+
+struct run_event_job
+{
+    struct run_event_state *state;
+    char *dump_dir_name;
+    char *event;
+    run_event_done_callback done_callback;
+    void *param;
+    int retval;
+    GList *link; /* in run_event_loop.running */
+};
+
+struct run_event_loop
+{
+    int epoll_fd;
+    GList *running;  /* struct run_event_job with a running command */
+    GList *finished; /* struct run_event_job to be reported, newest first */
+    unsigned job_count;
+    char *buffer;
+};
+
+struct run_event_loop *run_event_loop_new(void)
+{
+    struct run_event_loop *loop = xzalloc(sizeof(*loop));
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epoll_fd < 0)
+        perror_msg_and_die("epoll_create1");
+    loop->buffer = xmalloc(RUN_EVENT_LOOP_BUFFER_SIZE);
+    return loop;
+}
+
+static void free_run_event_job(struct run_event_job *job)
+{
+    free(job->dump_dir_name);
+    free(job->event);
+    free(job);
+}
+
+void run_event_loop_free(struct run_event_loop *loop)
+{
+    if (!loop)
+        return;
+
+    for (GList *iter = loop->running; iter; iter = g_list_next(iter))
+    {
+        struct run_event_job *job = iter->data;
+        close(job->state->command_out_fd);
+        close(job->state->command_in_fd);
+        free_commands(job->state);
+        free_run_event_job(job);
+    }
+    g_list_free(loop->running);
+
+    for (GList *iter = loop->finished; iter; iter = g_list_next(iter))
+        free_run_event_job(iter->data);
+    g_list_free(loop->finished);
+
+    close(loop->epoll_fd);
+    free(loop->buffer);
+    free(loop);
+}
+
+/* Starts the next command of the job, or moves the job to the finished ones
+ * if there is none or the previous one failed */
+static void run_event_loop_spawn_next(struct run_event_loop *loop, struct run_event_job *job)
+{
+    struct run_event_state *state = job->state;
+    if (job->retval == 0
+     && spawn_next_command(state, job->dump_dir_name, job->event, /*execflags:*/ 0) >= 0)
+    {
+        ndelay_on(state->command_out_fd);
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = job };
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, state->command_out_fd, &ev) != 0)
+            perror_msg_and_die("epoll_ctl");
+
+        if (!job->link)
+        {
+            loop->running = g_list_prepend(loop->running, job);
+            job->link = loop->running;
+        }
+        return;
+    }
+
+    if (job->link)
+    {
+        loop->running = g_list_delete_link(loop->running, job->link);
+        job->link = NULL;
+    }
+    loop->finished = g_list_prepend(loop->finished, job);
+}
+
+void run_event_loop_add(struct run_event_loop *loop,
+                        struct run_event_state *state,
+                        const char *dump_dir_name,
+                        const char *event,
+                        run_event_done_callback done_callback,
+                        void *param)
+{
+    struct run_event_job *job = xzalloc(sizeof(*job));
+    job->state = state;
+    job->dump_dir_name = xstrdup(dump_dir_name);
+    job->event = xstrdup(event);
+    job->done_callback = done_callback;
+    job->param = param;
+    loop->job_count++;
+
+    prepare_commands(state, dump_dir_name, event);
+    run_event_loop_spawn_next(loop, job);
+}
+
+/* Processes the output of the job's command which is ready for reading */
+static void run_event_loop_read(struct run_event_loop *loop, struct run_event_job *job)
+{
+    struct run_event_state *state = job->state;
+    const ssize_t r = read_command_output_chunk(state, state->command_out_fd, state->command_in_fd,
+                                                state->command_output, &state->command_stats,
+                                                loop->buffer, RUN_EVENT_LOOP_BUFFER_SIZE);
+    if (r > 0 || (r < 0 && errno == EAGAIN))
+        return;
+
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, state->command_out_fd, NULL);
+    close(state->command_out_fd);
+    close(state->command_in_fd);
+    strbuf_clear(state->command_output);
+
+    /* Wait for child to actually exit, collect status */
+    wait_for_command(state->command_pid, &(state->process_status), &state->command_stats, &state->command_start);
+    report_command_stats(state, job->dump_dir_name, &state->command_stats);
+    job->retval = command_exit_code(state, job->dump_dir_name);
+
+    run_event_loop_spawn_next(loop, job);
+}
+
+unsigned run_event_loop_iterate(struct run_event_loop *loop, int timeout)
+{
+    if (loop->running)
+    {
+        /* Don't delay reporting of the finished jobs */
+        if (loop->finished)
+            timeout = 0;
+
+        struct epoll_event events[RUN_EVENT_LOOP_MAX_EVENTS];
+        const int count = epoll_wait(loop->epoll_fd, events, ARRAY_SIZE(events), timeout);
+        if (count < 0 && errno != EINTR)
+            perror_msg_and_die("epoll_wait");
+
+        for (int i = 0; i < count; ++i)
+            run_event_loop_read(loop, events[i].data.ptr);
+    }
+
+    /* The callbacks can add new jobs */
+    GList *finished = g_list_reverse(loop->finished);
+    loop->finished = NULL;
+    for (GList *iter = finished; iter; iter = g_list_next(iter))
+    {
+        struct run_event_job *job = iter->data;
+        finish_commands(job->state, job->dump_dir_name);
+        loop->job_count--;
+        if (job->done_callback)
+            job->done_callback(job->state, job->dump_dir_name, job->retval, job->param);
+        free_run_event_job(job);
+    }
+    g_list_free(finished);
+
+    return loop->job_count;
+}
+
+void run_event_loop_run(struct run_event_loop *loop)
+{
+    while (run_event_loop_iterate(loop, -1) > 0)
+        continue;
+}
+
+
 static char *_list_possible_events(struct dump_dir **dd, problem_data_t *pd, const char *dump_dir_name, const char *pfx)
 {
     struct strbuf *result = strbuf_new();
 
-    GList *rule_list = load_rule_list(NULL, CONF_DIR"/report_event.conf", /*recursion_depth:*/ 0);
+    struct rule_index *index = rule_index_load();
+    GList *rule_list = rule_index_lookup_prefix(index, pfx);
+    /* No command runs here, every element is read only once */
+    struct condition_cache *cache = condition_cache_new();
 
     unsigned pfx_len = strlen(pfx);
     for (;;)
@@ -760,12 +2321,15 @@ static char *_list_possible_events(struct dump_dir **dd, problem_data_t *pd, con
                 &event_name,       /* return event_name */
                 dd,                /* match this dd... */
                 pd,                /* no problem data */
+                cache,             /* values of dd elements */
                 dump_dir_name,     /* ...or if NULL, this dirname */
                 pfx, pfx_len       /* for events with this prefix */
         );
         if (!cmd)
         {
-            free_rule_list(rule_list);
+            g_list_free(rule_list);
+            rule_index_free(index);
+            condition_cache_free(cache);
             free(event_name);
             break;
         }
@@ -806,7 +2370,7 @@ char *list_possible_events_problem_data(problem_data_t *pd, const char *dump_dir
 GList *list_possible_events_glist(const char *problem_dir_name,
                                   const char *pfx)
 {
-    struct dump_dir *dd = dd_opendir(problem_dir_name, DD_OPEN_READONLY);
+    struct dump_dir *dd = dd_opendir(problem_dir_name, DD_OPEN_SHARED);
     char *events = list_possible_events(dd, problem_dir_name, pfx);
     GList *l = parse_delimited_list(events, "\n");
     dd_close(dd);
@@ -18,8 +18,11 @@
  * with this program; if not, write to the Free Software Foundation, Inc.,
  * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
+#include <spawn.h>
 #include "internal_libreport.h"
 
+extern char **environ;
+
 static char *concat_str_vector(char **strings)
 {
 	if (!strings[0])
@@ -43,6 +46,123 @@ static char *concat_str_vector(char **strings)
 	return result;
 }
 
+/* Returns the environment of the parent with env_vec applied */
+static char **spawn_environment(char **env_vec)
+{
+	unsigned count = 0;
+	for (char **e = environ; *e; e++)
+		count++;
+	for (char **e = env_vec; *e; e++)
+		count++;
+
+	char **envp = xmalloc((count + 1) * sizeof(envp[0]));
+	char **out = envp;
+	for (char **e = environ; *e; e++) {
+		const size_t len = strchrnul(*e, '=') - *e;
+		char **v = env_vec;
+		while (*v && !(strncmp(*v, *e, len) == 0 && ((*v)[len] == '=' || (*v)[len] == '\0')))
+			v++;
+		if (!*v)
+			*out++ = *e;
+	}
+	/* Note: "var" without '=' *unsets* $var, as putenv() in glibc does */
+	for (char **v = env_vec; *v; v++)
+		if (strchr(*v, '='))
+			*out++ = *v;
+	*out = NULL;
+
+	return envp;
+}
+
+/* Starts the child by posix_spawn() which doesn't copy the page tables of
+ * the parent like fork() does.
+ * Returns pid, or -1 if the child can't be spawned this way. In that case
+ * nothing has been started and fork() has to be used.
+ */
+static pid_t spawn_on_steroids(int flags,
+		char **argv,
+		int *pipe_to_child,
+		int *pipe_fm_child,
+		char **env_vec,
+		const char *dir)
+{
+	if (flags & EXECFLG_SETGUID)
+		return -1;
+#if !HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	if (dir)
+		return -1;
+#endif
+#ifndef POSIX_SPAWN_SETSID
+	if (flags & EXECFLG_SETSID)
+		return -1;
+#endif
+	/* posix_spawnp() searches the PATH of the parent */
+	for (char **v = env_vec; v && *v; v++)
+		if (strncmp(*v, "PATH", 4) == 0 && ((*v)[4] == '=' || (*v)[4] == '\0'))
+			return -1;
+
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+
+	/* The same order of operations as in the forked child */
+#if HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCHDIR_NP
+	if (dir)
+		posix_spawn_file_actions_addchdir_np(&actions, dir);
+#endif
+	if (flags & EXECFLG_INPUT) {
+		posix_spawn_file_actions_addclose(&actions, pipe_to_child[1]);
+		posix_spawn_file_actions_adddup2(&actions, pipe_to_child[0], STDIN_FILENO);
+		if (pipe_to_child[0] != STDIN_FILENO)
+			posix_spawn_file_actions_addclose(&actions, pipe_to_child[0]);
+	} else if (flags & EXECFLG_INPUT_NUL) {
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDWR, 0);
+	}
+	if (flags & EXECFLG_OUTPUT) {
+		posix_spawn_file_actions_addclose(&actions, pipe_fm_child[0]);
+		posix_spawn_file_actions_adddup2(&actions, pipe_fm_child[1], STDOUT_FILENO);
+		if (pipe_fm_child[1] != STDOUT_FILENO)
+			posix_spawn_file_actions_addclose(&actions, pipe_fm_child[1]);
+	} else if (flags & EXECFLG_OUTPUT_NUL) {
+		posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_RDWR, 0);
+	}
+	if (flags & EXECFLG_ERR2OUT) {
+		posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+	} else if (flags & EXECFLG_ERR_NUL) {
+		posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_RDWR, 0);
+	}
+
+	short spawn_flags = 0;
+#ifdef POSIX_SPAWN_SETSID
+	if (flags & EXECFLG_SETSID)
+		spawn_flags |= POSIX_SPAWN_SETSID;
+#endif
+	if (flags & EXECFLG_SETPGID) {
+		spawn_flags |= POSIX_SPAWN_SETPGROUP;
+		posix_spawnattr_setpgroup(&attr, 0);
+	}
+	posix_spawnattr_setflags(&attr, spawn_flags);
+
+	char **envp = env_vec ? spawn_environment(env_vec) : environ;
+
+	pid_t child;
+	const int r = posix_spawnp(&child, argv[0], &actions, &attr, argv, envp);
+
+	if (envp != environ)
+		free(envp);
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (r != 0) {
+		/* Let the forked child report the error the usual way */
+		log_debug("Can't spawn '%s': %s", argv[0], strerror(r));
+		return -1;
+	}
+
+	return child;
+}
+
 /* Returns pid */
 pid_t fork_execv_on_steroids(int flags,
 		char **argv,
@@ -60,10 +180,16 @@ pid_t fork_execv_on_steroids(int flags,
 	if (!pipefds)
 		flags &= ~(EXECFLG_INPUT | EXECFLG_OUTPUT);
 
-	if (flags & EXECFLG_INPUT)
+	/* The ends of the parent must not leak to the children started while
+	 * this one runs, e.g. by the event loops running many commands */
+	if (flags & EXECFLG_INPUT) {
 		xpipe(pipe_to_child);
-	if (flags & EXECFLG_OUTPUT)
+		close_on_exec_on(pipe_to_child[1]);
+	}
+	if (flags & EXECFLG_OUTPUT) {
 		xpipe(pipe_fm_child);
+		close_on_exec_on(pipe_fm_child[0]);
+	}
 
 	/* Prepare it before fork, to avoid thread-unsafe malloc there */
 	char *prog_as_string = NULL;
@@ -75,6 +201,12 @@ pid_t fork_execv_on_steroids(int flags,
 	}
 
 	fflush(NULL);
+	child = spawn_on_steroids(flags, argv, pipe_to_child, pipe_fm_child, env_vec, dir);
+	if (child > 0) {
+		log_info("Executing: %s", prog_as_string);
+		goto parent;
+	}
+
 	child = fork();
 	if (child == -1) {
 		perror_msg_and_die("fork");
@@ -137,6 +269,7 @@ pid_t fork_execv_on_steroids(int flags,
 	}
 
 	/* Parent */
+ parent:
 	free(prog_as_string);
 
 	if (flags & EXECFLG_INPUT) {
@@ -151,6 +284,68 @@ pid_t fork_execv_on_steroids(int flags,
 	return child;
 }
 
+/* Words which the shell handles itself */
+static const char *const shell_words[] = {
+	"!", ".", ":", "[", "alias", "bg", "bind", "break", "builtin", "caller",
+	"case", "cd", "command", "compgen", "complete", "compopt", "continue",
+	"coproc", "declare", "dirs", "disown", "do", "done", "echo", "elif",
+	"else", "enable", "esac", "eval", "exec", "exit", "export", "false", "fc",
+	"fg", "fi", "for", "function", "getopts", "hash", "help", "history", "if",
+	"in", "jobs", "kill", "let", "local", "logout", "mapfile", "popd",
+	"printf", "pushd", "pwd", "read", "readarray", "readonly", "return",
+	"select", "set", "shift", "shopt", "source", "suspend", "test", "then",
+	"time", "times", "trap", "true", "type", "typeset", "ulimit", "umask",
+	"unalias", "unset", "until", "wait", "while",
+	NULL
+};
+
+/* Characters which have no special meaning for the shell */
+static bool is_plain_char(char c)
+{
+	return isalnum((unsigned char)c) || (c != '\0' && strchr("_-./,:+@=", c));
+}
+
+char **split_shell_command(const char *cmd)
+{
+	unsigned count = 0;
+	const char *p = skip_whitespace(cmd);
+	while (*p) {
+		const char *end = p;
+		while (*end && !isblank(*end)) {
+			if (!is_plain_char(*end))
+				return NULL;
+			end++;
+		}
+
+		if (count == 0) {
+			/* "VAR=VAL cmd" sets a variable */
+			if (memchr(p, '=', end - p))
+				return NULL;
+			for (const char *const *w = shell_words; *w; w++)
+				if (strncmp(*w, p, end - p) == 0 && (*w)[end - p] == '\0')
+					return NULL;
+		}
+
+		count++;
+		p = skip_blank(end);
+	}
+
+	/* Newlines separate commands */
+	if (count == 0 || strchr(cmd, '\n'))
+		return NULL;
+
+	char **argv = g_new0(char *, count + 1);
+	unsigned i = 0;
+	p = skip_whitespace(cmd);
+	while (*p) {
+		const char *end = skip_non_whitespace(p);
+		argv[i++] = g_strndup(p, end - p);
+		p = skip_blank(end);
+	}
+
+	return argv;
+}
+
 char *run_in_shell_and_save_output(int flags,
 		const char *cmd,
 		const char *dir,
@@ -713,7 +713,7 @@ ureport_from_dump_dir_ext(const char *dump_dir_path, const struct ureport_prefer
 
     if (preferences != NULL && preferences->urp_auth_items != NULL)
     {
-        struct dump_dir *dd = dd_opendir(dump_dir_path, DD_OPEN_READONLY);
+        struct dump_dir *dd = dd_opendir(dump_dir_path, DD_OPEN_SHARED);
         if (!dd)
             xfunc_die(); /* dd_opendir() already printed an error message */
 
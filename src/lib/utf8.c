@@ -16,11 +16,42 @@
     with this program; if not, write to the Free Software Foundation, Inc.,
     51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "internal_libreport.h"
 
+/* Returns the length of the leading run of printable ASCII chars (' '..0x7f),
+ * which never need to be sanitized.
+ */
+static size_t printable_ascii_prefix(const char *src, size_t size)
+{
+    size_t i = 0;
+#ifdef __SSE2__
+    const __m128i space = _mm_set1_epi8(' ');
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        /* Signed comparison: bytes >= 0x80 are negative, hence less too */
+        const int mask = _mm_movemask_epi8(_mm_cmplt_epi8(v, space));
+        if (mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+#endif
+    for (; i < size; ++i)
+    {
+        const unsigned char c = src[i];
+        if (c < ' ' || c > 0x7f)
+            break;
+    }
+
+    return i;
+}
+
 char *sanitize_utf8(const char *src, uint32_t control_chars_to_sanitize)
 {
     const char *initial_src = src;
+    const char *const src_end = src + strlen(src);
     char *sanitized = NULL;
     unsigned sanitized_pos = 0;
 
@@ -28,6 +59,21 @@ char *sanitize_utf8(const char *src, uint32_t control_chars_to_sanitize)
     {
         int bytes = 0;
 
+        /* Fast path for the usual case: plain ASCII text */
+        const size_t plain = printable_ascii_prefix(src, src_end - src);
+        if (plain != 0)
+        {
+            if (sanitized)
+            {
+                sanitized = (char*) xrealloc(sanitized, sanitized_pos + plain + 1);
+                memcpy(sanitized + sanitized_pos, src, plain);
+                sanitized_pos += plain;
+                sanitized[sanitized_pos] = '\0';
+            }
+            src += plain;
+            continue;
+        }
+
         unsigned c = (unsigned char) *src;
         if (c <= 0x7f)
         {
@@ -159,6 +159,25 @@ GHashTable *load_workflow_config_data(const char *path)
     return g_workflow_list;
 }
 
+void reload_workflow_config(const char *name)
+{
+    if (!g_workflow_list)
+        return;
+
+    char *path = xasprintf(WORKFLOWS_DIR"/%s.xml", name);
+    if (access(path, F_OK) == 0)
+    {
+        workflow_t *workflow = new_workflow(name);
+        load_workflow_description_from_file(workflow, path);
+        /* Frees the previous one */
+        g_hash_table_replace(g_workflow_list, xstrdup(name), workflow);
+    }
+    else
+        g_hash_table_remove(g_workflow_list, name);
+
+    free(path);
+}
+
 config_item_info_t *workflow_get_config_info(workflow_t *w)
 {
     return w->info;
@@ -346,7 +346,7 @@ int main(int argc, char **argv)
     if (opts & OPT_d)
     {
         /* pull in some defaults from os-release */
-        problem_data = create_problem_data_for_reporting(dump_dir_name);
+        problem_data = create_problem_data_for_reporting_ext(dump_dir_name, PROBLEM_DATA_LOAD_LAZILY);
         if (!problem_data)
             xfunc_die(); /* create_problem_data_for_reporting already emitted error msg */
         else
@@ -574,7 +574,7 @@ int main(int argc, char **argv)
     }
 
     if (!(opts & OPT_d))
-        problem_data = create_problem_data_for_reporting(dump_dir_name);
+        problem_data = create_problem_data_for_reporting_ext(dump_dir_name, PROBLEM_DATA_LOAD_LAZILY);
 
     if (!problem_data)
         xfunc_die(); /* create_problem_data_for_reporting already emitted error msg */
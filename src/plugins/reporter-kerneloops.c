@@ -89,7 +89,7 @@ static void report_to_kerneloops(
                 const char *dump_dir_name,
                 map_string_t *settings)
 {
-    problem_data_t *problem_data = create_problem_data_for_reporting(dump_dir_name);
+    problem_data_t *problem_data = create_problem_data_for_reporting_ext(dump_dir_name, PROBLEM_DATA_LOAD_LAZILY);
     if (!problem_data)
         xfunc_die(); /* create_problem_data_for_reporting already emitted error msg */
 
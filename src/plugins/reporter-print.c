@@ -21,15 +21,190 @@
 #include "internal_libreport.h"
 #include "client.h"
 
-static const char *dump_dir_name = ".";
+#if REPORTER_PLUGIN
+# include "reporter_plugin.h"
+#endif
+
 static char *output_file = NULL;
 static const char *append = "no";
 static const char *open_mode = "w";
 
+/* Opens output_file, asks for another file name if it can't be opened.
+ * Returns NULL if the user cancelled reporting.
+ */
+static FILE *open_output_file(char *(*ask_fn)(const char *msg, void *param), void *param)
+{
+    char *HOME;
+    if (output_file[0] == '~' && output_file[1] == '/'
+     && (HOME = getenv("HOME")) != NULL
+    ) {
+        output_file = concat_path_file(HOME, output_file + 2);
+    }
+    else
+        output_file = xstrdup(output_file);
+
+    if (string_to_bool(append))
+        open_mode = "a";
+
+    /* We used freopen to change stdout,
+     * but ask() writes to stdout. Can't use that trick anymore.
+     */
+    char *msg = NULL;
+    while (1)
+    {
+        /* prompt for another file name if needed */
+        if (msg)
+        {
+            free(output_file);
+            output_file = NULL;
+            char *response = ask_fn(msg, param);
+            free(msg);
+            if (!response)
+                return NULL;
+
+            if (response[0] == '\0' || response[0] == '\n')
+            {
+                free(response);
+                error_msg(_("Cancelled by user."));
+                return NULL;
+            }
+
+            output_file = strtrim(response);
+        }
+
+        FILE *outstream = fopen(output_file, open_mode);
+        if (outstream)
+            return outstream;
+
+        VERB1 pwarn_msg("fopen");
+        msg = xasprintf(_("Can't open '%s' for writing. "
+                          "Please select another file:"), output_file);
+    }
+}
+
+static void print_problem(problem_data_t *problem_data, FILE *outstream)
+{
+    char *dsc = make_description_logger(problem_data, CD_TEXT_ATT_SIZE_LOGGER);
+    fputs(dsc, outstream);
+    if (open_mode[0] == 'a')
+        fputs("\nEND:\n\n", outstream);
+    free(dsc);
+}
+
+static void log_output_file(void)
+{
+    const char *format = (open_mode[0] == 'a' ? _("The report was appended to %s") : _("The report was stored to %s"));
+    log_warning(format, output_file);
+}
+
+#if REPORTER_PLUGIN
+
+static char *ask_state(const char *msg, void *param)
+{
+    struct run_event_state *state = param;
+    return state->ask_callback(msg, state->interaction_param);
+}
+
+/* Called by run_event_on_problem_data() instead of executing reporter-print */
+static int plugin_report(int argc, char **argv,
+                problem_data_t *problem_data,
+                map_string_t *settings,
+                struct run_event_state *state)
+{
+    /* The plugin stays loaded for the next problem */
+    output_file = NULL;
+    append = "no";
+    open_mode = "w";
+
+    bool add_reported_to = false;
+    int c;
+    while ((c = getopt(argc, argv, "vd:o:a:r")) != -1)
+    {
+        switch (c)
+        {
+            case 'v': /* the verbosity of the caller is used */
+            case 'd': /* the problem is already loaded */
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'a':
+                append = optarg;
+                break;
+            case 'r':
+                add_reported_to = true;
+                break;
+            default:
+                return 1;
+        }
+    }
+
+    if (!output_file)
+    {
+        /* Lines the program prints are forwarded to the logging callback */
+        char *dsc = make_description_logger(problem_data, CD_TEXT_ATT_SIZE_LOGGER);
+        for (char *line = dsc; *line && state->logging_callback; )
+        {
+            char *end = strchrnul(line, '\n');
+            char *logged = state->logging_callback(xstrndup(line, end - line), state->logging_param);
+            free(logged);
+            line = *end ? end + 1 : end;
+        }
+        free(dsc);
+        return 0;
+    }
+
+    FILE *outstream = open_output_file(ask_state, state);
+    if (!outstream)
+    {
+        free(output_file);
+        output_file = NULL;
+        return EXIT_CANCEL_BY_USER;
+    }
+
+    print_problem(problem_data, outstream);
+    fclose(outstream);
+
+    if (add_reported_to)
+    {
+        char *reported_to = xstrdup(problem_data_get_content_or_NULL(problem_data, FILENAME_REPORTED_TO));
+        report_result_t rr = { .label = (char *)"file" };
+        rr.url = xasprintf("file://%s", output_file);
+        add_reported_to_entry_data(&reported_to, &rr);
+        problem_data_add_text_noteditable(problem_data, FILENAME_REPORTED_TO, reported_to);
+        free(rr.url);
+        free(reported_to);
+    }
+
+    log_output_file();
+    free(output_file);
+    output_file = NULL;
+
+    return 0;
+}
+
+const struct reporter_plugin libreport_reporter_plugin = {
+    .abi_version = REPORTER_PLUGIN_ABI_VERSION,
+    .name = "reporter-print",
+    .report = plugin_report,
+};
+
+#else /* REPORTER_PLUGIN */
+
+static char *ask_client(const char *msg, void *param)
+{
+    char *response = ask(msg);
+    if (!response)
+        perror_msg_and_die("ask");
+    return response;
+}
+
 int main(int argc, char **argv)
 {
     abrt_init(argv);
 
+    const char *dump_dir_name = ".";
+
     /* I18n */
     setlocale(LC_ALL, "");
 #if ENABLE_NLS
@@ -63,72 +238,28 @@ int main(int argc, char **argv)
 
     export_abrt_envvars(0);
 
+    FILE *outstream = stdout;
     if (output_file)
     {
-        char *HOME;
-        if (output_file[0] == '~' && output_file[1] == '/'
-         && (HOME = getenv("HOME")) != NULL
-        ) {
-            output_file = concat_path_file(HOME, output_file + 2);
-        }
-        else
-            output_file = xstrdup(output_file);
-
-        if (string_to_bool(append))
-            open_mode = "a";
-
-        /* We used freopen to change stdout,
-         * but ask() writes to stdout. Can't use that trick anymore.
-         */
-        char *msg = NULL;
-        while (1)
+        outstream = open_output_file(ask_client, NULL);
+        if (!outstream)
         {
-            /* prompt for another file name if needed */
-            if (msg)
-            {
-                free(output_file);
-                char *response = ask(msg);
-                if (!response)
-                    perror_msg_and_die("ask");
-                free(msg);
-
-                if (response[0] == '\0' || response[0] == '\n')
-                {
-                    set_xfunc_error_retval(EXIT_CANCEL_BY_USER);
-                    error_msg_and_die(_("Cancelled by user."));
-                }
-
-                output_file = strtrim(response);
-            }
-
-            FILE *outstream = fopen(output_file, open_mode);
-            if (!outstream)
-            {
-                VERB1 pwarn_msg("fopen");
-                msg = xasprintf(_("Can't open '%s' for writing. "
-                                  "Please select another file:"), output_file);
-                continue;
-            }
-
-            fclose(stdout);
-            stdout = outstream;
-            break;
+            set_xfunc_error_retval(EXIT_CANCEL_BY_USER);
+            xfunc_die();
         }
     }
 
-    problem_data_t *problem_data = create_problem_data_for_reporting(dump_dir_name);
+    problem_data_t *problem_data = create_problem_data_for_reporting_ext(dump_dir_name, PROBLEM_DATA_LOAD_LAZILY);
     if (!problem_data)
         xfunc_die(); /* create_problem_data_for_reporting already emitted error msg */
 
-    char *dsc = make_description_logger(problem_data, CD_TEXT_ATT_SIZE_LOGGER);
-    fputs(dsc, stdout);
-    if (open_mode[0] == 'a')
-        fputs("\nEND:\n\n", stdout);
-    free(dsc);
+    print_problem(problem_data, outstream);
     problem_data_free(problem_data);
 
     if (output_file)
     {
+        fclose(outstream);
+
         if (opts & OPT_r)
         {
             struct dump_dir *dd = dd_opendir(dump_dir_name, /*flags:*/ 0);
@@ -141,10 +272,11 @@ int main(int argc, char **argv)
                 dd_close(dd);
             }
         }
-        const char *format = (open_mode[0] == 'a' ? _("The report was appended to %s") : _("The report was stored to %s"));
-        log_warning(format, output_file);
+        log_output_file();
         free(output_file);
     }
 
     return 0;
 }
+
+#endif /* REPORTER_PLUGIN */
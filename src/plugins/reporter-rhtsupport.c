@@ -81,26 +81,25 @@ int create_tarball(const char *tempfile, struct dump_dir *dd,
     reportfile_t *file = NULL;
     int retval = 0; /* everything is ok so far .. */
 
-    int pipe_from_parent_to_child[2];
-    xpipe(pipe_from_parent_to_child);
-    pid_t child = fork();
-    if (child == 0)
+    const int archive_fd = xopen3(tempfile, O_WRONLY | O_CREAT | O_EXCL, 0600);
+    struct compressor *compressor = NULL;
+    int tar_wfd = compressor_start(COMPRESSION_GZIP, archive_fd, &compressor);
+    if (tar_wfd < 0)
     {
-        /* child */
-        close(pipe_from_parent_to_child[1]);
-        xmove_fd(xopen3(tempfile, O_WRONLY | O_CREAT | O_EXCL, 0600), 1);
-        xmove_fd(pipe_from_parent_to_child[0], 0);
-        execlp("gzip", "gzip", NULL);
-        perror_msg_and_die("Can't execute '%s'", "gzip");
+        close(archive_fd);
+        dd_close(dd);
+        return 1;
     }
-    close(pipe_from_parent_to_child[0]);
 
     TAR *tar = NULL;
-    if (tar_fdopen(&tar, pipe_from_parent_to_child[1], (char*)tempfile,
+    if (tar_fdopen(&tar, tar_wfd, (char*)tempfile,
                 /*fileops:(standard)*/ NULL, O_WRONLY | O_CREAT, 0644, TAR_GNU) != 0)
     {
+        tar = NULL;
         goto ret_fail;
     }
+    /* tar_close() closes the write end from now on */
+    tar_wfd = -1;
 
     file = new_reportfile();
     {
@@ -187,33 +186,28 @@ int create_tarball(const char *tempfile, struct dump_dir *dd,
         free(block);
     }
 
-    /* We must be sure gzip finished, and finished successfully */
-    int status;
-    safe_waitpid(child, &status, 0);
-    child = -1;
-    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    /* We must be sure the compression finished, and finished successfully */
+    if (compressor_finish(compressor) != 0)
     {
-        /* Hopefully, by this time child emitted more meaningful
-         * error message. But just in case it didn't:
-         */
+        compressor = NULL;
         goto ret_fail;
     }
+    compressor = NULL;
+    close(archive_fd);
     goto ret_clean; /* success */
 
 ret_fail:
     retval = 1; /* failure */
-    /* We must close write fd first, or else child will wait forever */
+    /* We must close write fd first, or else the compressor will wait forever */
     if (tar)
         tar_close(tar);
-    //close(pipe_from_parent_to_child[1]); - tar_close() does it itself
+    else if (tar_wfd >= 0)
+        close(tar_wfd);
 
-    /* Now wait for child to exit */
-    if (child > 0)
-    {
-        // Damn, selinux does not allow SIGKILLing our own child! wtf??
-        //kill(child, SIGKILL); /* just in case */
-        safe_waitpid(child, NULL, 0);
-    }
+    /* Now wait for the compressor to finish */
+    if (compressor)
+        compressor_finish(compressor);
+    close(archive_fd);
 
 ret_clean:
     dd_close(dd);
@@ -257,7 +251,7 @@ struct ureport_server_response *ureport_do_post_credentials(const char *json, st
 static
 char *submit_ureport(const char *dump_dir_name, struct ureport_server_config *conf)
 {
-    struct dump_dir *dd = dd_opendir(dump_dir_name, DD_OPEN_READONLY);
+    struct dump_dir *dd = dd_opendir(dump_dir_name, DD_OPEN_SHARED);
     if (dd == NULL)
         return NULL;
 
@@ -275,7 +275,7 @@ int main(int argc, char **argv)
 
     export_abrt_envvars(0);
 
-    problem_data_t *problem_data = create_problem_data_for_reporting(dump_dir_name);
+    problem_data_t *problem_data = create_problem_data_for_reporting_ext(dump_dir_name, PROBLEM_DATA_LOAD_LAZILY);
     if (!problem_data)
         xfunc_die(); /* create_problem_data_for_reporting already emitted error msg */
 
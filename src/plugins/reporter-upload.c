@@ -32,7 +32,31 @@ static char *ask_url(const char *message)
     return url;
 }
 
+struct archive_stream
+{
+    struct dump_dir *dd;
+    const char *archive_name;
+    string_vector_ptr_t exclude_elements;
+};
+
+static int write_archive_to_stream(int fd, void *args)
+{
+    struct archive_stream *stream = (struct archive_stream *)args;
+    return dd_write_archive(stream->dd, fd, stream->archive_name,
+            (const_string_vector_const_ptr_t)stream->exclude_elements, 0);
+}
+
+/* scp needs to know the file size before the upload starts */
+static bool can_stream_upload(const char *url)
+{
+    return strncasecmp(url, "scp:", strlen("scp:")) != 0;
+}
+
+/* If stream is not NULL, the archive is uploaded while it is being created
+ * and file_name is used only to create the remote name.
+ */
 static int interactive_upload_file(const char *url, const char *file_name,
+                                   struct archive_stream *stream,
                                    map_string_t *settings, char **remote_name)
 {
     post_state_t *state = new_post_state(POST_WANT_ERROR_MSG);
@@ -63,7 +87,12 @@ static int interactive_upload_file(const char *url, const char *file_name,
     if (state->client_ssh_private_keyfile != NULL)
         log_debug("Using SSH private key '%s'", state->client_ssh_private_keyfile);
 
-    char *tmp = upload_file_ext(state, url, file_name, UPLOAD_FILE_HANDLE_ACCESS_DENIALS);
+    char *tmp = NULL;
+    if (stream)
+        tmp = upload_stream_ext(state, url, file_name, write_archive_to_stream, stream,
+                                UPLOAD_FILE_HANDLE_ACCESS_DENIALS);
+    else
+        tmp = upload_file_ext(state, url, file_name, UPLOAD_FILE_HANDLE_ACCESS_DENIALS);
 
     if (remote_name)
         *remote_name = tmp;
@@ -99,6 +128,25 @@ static int create_and_upload_archive(
     if (!dd)
         xfunc_die(); /* error msg is already logged by dd_opendir */
 
+    /* Compress and upload at once, no need for the temporary file */
+    if (url && url[0] && can_stream_upload(url)
+        && strcmp(url, "file://"LARGE_DATA_TMP_DIR"/") != 0)
+    {
+        struct archive_stream stream = {
+            .dd = dd,
+            .archive_name = tempfile,
+            .exclude_elements = exclude_from_report,
+        };
+
+        log_warning(_("Compressing and uploading data"));
+        result = interactive_upload_file(url, tempfile, &stream, settings, remote_name);
+
+        /* Nothing was written to the disk */
+        free(tempfile);
+        tempfile = NULL;
+        goto ret;
+    }
+
     /* Compressing e.g. 0.5gig coredump takes a while. Let client know what we are doing */
     log_warning(_("Compressing data"));
     if (dd_create_archive(dd, tempfile, (const_string_vector_const_ptr_t)exclude_from_report, 0) != 0)
@@ -113,7 +161,7 @@ static int create_and_upload_archive(
     /* Upload the archive */
     /* Upload from /tmp to /tmp + deletion -> BAD, exclude this possibility */
     if (url && url[0] && strcmp(url, "file://"LARGE_DATA_TMP_DIR"/") != 0)
-        result = interactive_upload_file(url, tempfile, settings, remote_name);
+        result = interactive_upload_file(url, tempfile, /*stream*/NULL, settings, remote_name);
     else
     {
         result = 0; /* success */
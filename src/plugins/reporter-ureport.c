@@ -176,7 +176,7 @@ int main(int argc, char **argv)
 
     if (ureport_hash_from_rt || rhbz_bug_from_rt || comment_file || attach_value_from_rt)
     {
-        dd = dd_opendir(dump_dir_path, DD_OPEN_READONLY);
+        dd = dd_opendir(dump_dir_path, DD_OPEN_SHARED);
         if (!dd)
             xfunc_die();
 